@@ -0,0 +1,340 @@
+/**
+* Barnes-Hut octree gravity.
+*
+* The tree is rebuilt from scratch every step. Cells are opened using the
+* criterion of Barnes (1994): a cell of side s whose centre of mass lies at
+* distance r from the particle is accepted when r > s/theta + delta, where
+* delta is the offset between the centre of mass and the geometric centre of
+* the cell. Accepted cells act as a point mass using the same softened force
+* law as the direct sum, so theta -> 0 recovers the direct sum exactly.
+*
+* A parallel build splits the work at a frontier of cells: the cells above
+* it are built first, each frontier cell's subtree is then built into its
+* own node array by a task, and the arrays are appended to the tree. The
+* subtrees work on disjoint ranges of index, so they need no locking.
+*/
+
+#include <algorithm>
+#include <math.h>
+
+#include "barnes_hut.h"
+
+/*
+* A cell at the frontier of a parallel build: octant oct of node parent,
+* holding index[begin..end).
+*/
+struct bh_subtree {
+  int parent, oct;
+  size_t begin, end;
+  float cx, cy, cz, half;
+  int depth;
+};
+
+/*
+* Recursively build the cell covering index[begin..end) into nodes. If
+* frontier is given, children of more than leaf_size and at most split
+* particles are not built but appended to it, with child[oct] left at -1.
+* @return Index of the new cell in nodes.
+*/
+static int
+build_node(std::vector<bh_node> &nodes, std::vector<bh_subtree> *frontier,
+  size_t split, size_t *index, size_t *octant, size_t *sorted,
+  const float *px, const float *py, const float *pz, const float *mass,
+  size_t begin, size_t end, float cx, float cy, float cz, float half, int depth,
+  size_t leaf_size)
+{
+  int id = (int) nodes.size();
+  nodes.push_back(bh_node());
+
+  bh_node node;
+  node.cx = cx;
+  node.cy = cy;
+  node.cz = cz;
+  node.half = half;
+  node.begin = begin;
+  node.end = end;
+  node.leaf = 1;
+  for (int k = 0; k < 8; ++k) {
+    node.child[k] = -1;
+  }
+
+  // Accumulate mass and centre of mass in double to limit round-off.
+  double m = 0.0, mx = 0.0, my = 0.0, mz = 0.0;
+  for (size_t k = begin; k < end; ++k) {
+    size_t j = index[k];
+    m += mass[j];
+    mx += (double) mass[j]*px[j];
+    my += (double) mass[j]*py[j];
+    mz += (double) mass[j]*pz[j];
+  }
+  node.mass = (float) m;
+  if (m > 0.0) {
+    node.mx = (float) (mx/m);
+    node.my = (float) (my/m);
+    node.mz = (float) (mz/m);
+  } else {
+    node.mx = cx;
+    node.my = cy;
+    node.mz = cz;
+  }
+
+  if (end - begin > leaf_size && depth < BH_MAX_DEPTH) {
+    // Counting sort of the particles into the eight octants.
+    size_t count[8] = {0};
+    for (size_t k = begin; k < end; ++k) {
+      size_t j = index[k];
+      int oct = (px[j] >= cx) | ((py[j] >= cy) << 1) | ((pz[j] >= cz) << 2);
+      octant[k] = (size_t) oct;
+      count[oct]++;
+    }
+
+    size_t start[9];
+    start[0] = begin;
+    for (int k = 0; k < 8; ++k) {
+      start[k + 1] = start[k] + count[k];
+    }
+
+    size_t pos[8];
+    std::copy(start, start + 8, pos);
+    for (size_t k = begin; k < end; ++k) {
+      sorted[pos[octant[k]]++] = index[k];
+    }
+    std::copy(sorted + begin, sorted + end, index + begin);
+
+    node.leaf = 0;
+    float h = 0.5f*half;
+    for (int k = 0; k < 8; ++k) {
+      if (count[k] == 0) {
+        continue;
+      }
+      float ox = (k & 1) ? h : -h;
+      float oy = (k & 2) ? h : -h;
+      float oz = (k & 4) ? h : -h;
+      if (frontier && count[k] > leaf_size && count[k] <= split) {
+        bh_subtree sub = {id, k, start[k], start[k + 1], cx + ox, cy + oy,
+          cz + oz, h, depth + 1};
+        frontier->push_back(sub);
+        continue;
+      }
+      node.child[k] = build_node(nodes, frontier, split, index, octant,
+        sorted, px, py, pz, mass, start[k], start[k + 1], cx + ox, cy + oy,
+        cz + oz, h, depth + 1, leaf_size);
+    }
+  }
+
+  nodes[id] = node;
+  return id;
+}
+
+// Shared data of the subtree tasks of a parallel build.
+struct bh_build_args {
+  std::vector<bh_subtree> *frontier;
+  std::vector<std::vector<bh_node> > *parts;
+  std::vector<size_t> *base;
+  bh_tree *tree;
+  size_t *octant, *sorted;
+  const float *px, *py, *pz, *mass;
+  size_t leaf_size;
+};
+
+static void
+build_subtrees(void *ctx, size_t begin, size_t end)
+{
+  bh_build_args &a = *(bh_build_args *) ctx;
+  for (size_t f = begin; f < end; ++f) {
+    const bh_subtree &sub = (*a.frontier)[f];
+    std::vector<bh_node> &part = (*a.parts)[f];
+    part.clear();
+    build_node(part, NULL, 0, &a.tree->index[0], a.octant, a.sorted,
+      a.px, a.py, a.pz, a.mass, sub.begin, sub.end, sub.cx, sub.cy, sub.cz,
+      sub.half, sub.depth, a.leaf_size);
+  }
+}
+
+// Copy the subtrees into the tree, shifting their child indices.
+static void
+append_subtrees(void *ctx, size_t begin, size_t end)
+{
+  bh_build_args &a = *(bh_build_args *) ctx;
+  for (size_t f = begin; f < end; ++f) {
+    const std::vector<bh_node> &part = (*a.parts)[f];
+    int base = (int) (*a.base)[f];
+    bh_node *out = &a.tree->nodes[base];
+    for (size_t n = 0; n < part.size(); ++n) {
+      out[n] = part[n];
+      for (int k = 0; k < 8; ++k) {
+        out[n].child[k] += out[n].child[k] >= 0 ? base : 0;
+      }
+    }
+  }
+}
+
+void
+bh_build(bh_tree &tree, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  size_t leaf_size, ws_pool *pool)
+{
+  tree.nodes.clear();
+  tree.index.resize(npart);
+  if (npart == 0) {
+    return;
+  }
+
+  // Bounding cube of all particles.
+  float xmin = px[0], xmax = px[0];
+  float ymin = py[0], ymax = py[0];
+  float zmin = pz[0], zmax = pz[0];
+  for (size_t i = 0; i < npart; ++i) {
+    tree.index[i] = i;
+    xmin = std::min(xmin, px[i]); xmax = std::max(xmax, px[i]);
+    ymin = std::min(ymin, py[i]); ymax = std::max(ymax, py[i]);
+    zmin = std::min(zmin, pz[i]); zmax = std::max(zmax, pz[i]);
+  }
+
+  float half = 0.5f*std::max(xmax - xmin, std::max(ymax - ymin, zmax - zmin));
+  half = half*1.001f + 1e-6f;
+
+  std::vector<size_t> octant(npart), sorted(npart);
+  std::vector<bh_subtree> frontier;
+  size_t split = pool ? npart/(BH_SUBTREES_PER_WORKER*ws_workers(*pool)) : 0;
+  tree.nodes.reserve(2*npart/leaf_size + 1);
+  build_node(tree.nodes, pool ? &frontier : NULL, split, &tree.index[0],
+    &octant[0], &sorted[0], px, py, pz, mass, 0, npart,
+    0.5f*(xmin + xmax), 0.5f*(ymin + ymax), 0.5f*(zmin + zmax), half, 0,
+    leaf_size);
+  if (frontier.empty()) {
+    return;
+  }
+
+  size_t nf = frontier.size();
+  std::vector<std::vector<bh_node> > parts(nf);
+  std::vector<size_t> base(nf);
+  bh_build_args args = {&frontier, &parts, &base, &tree, &octant[0],
+    &sorted[0], px, py, pz, mass, leaf_size};
+  ws_for(*pool, nf, 1, build_subtrees, &args);
+
+  size_t total = tree.nodes.size();
+  for (size_t f = 0; f < nf; ++f) {
+    base[f] = total;
+    total += parts[f].size();
+    tree.nodes[frontier[f].parent].child[frontier[f].oct] = (int) base[f];
+  }
+  tree.nodes.resize(total);
+  ws_for(*pool, nf, 1, append_subtrees, &args);
+}
+
+// Data of a tree walk, shared by its ranges of particles.
+struct bh_walk_args {
+  const bh_node *nodes;
+  const size_t *index;
+  const float *px, *py, *pz, *mass;
+  float *ax, *ay, *az;
+  float G, eps, inv_theta;
+  unsigned *work;
+};
+
+/*
+* Walk the tree for particles begin..end-1.
+*/
+static void
+walk(void *ctx, size_t begin, size_t end)
+{
+  const bh_walk_args &a = *(const bh_walk_args *) ctx;
+  const bh_node *nodes = a.nodes;
+  const size_t *index = a.index;
+  const float *px = a.px, *py = a.py, *pz = a.pz, *mass = a.mass;
+  float G = a.G, eps = a.eps, inv_theta = a.inv_theta;
+
+  for (size_t i = begin; i < end; ++i) {
+    float xi = px[i];
+    float yi = py[i];
+    float zi = pz[i];
+
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+    unsigned interactions = 0;
+
+    int stack[8*(BH_MAX_DEPTH + 1)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+      const bh_node &node = nodes[stack[--top]];
+
+      float dx = node.mx - xi;
+      float dy = node.my - yi;
+      float dz = node.mz - zi;
+      float r2 = dx*dx + dy*dy + dz*dz;
+
+      if (!node.leaf) {
+        float ox = node.mx - node.cx;
+        float oy = node.my - node.cy;
+        float oz = node.mz - node.cz;
+        float open = 2.0f*node.half*inv_theta + sqrt(ox*ox + oy*oy + oz*oz);
+
+        if (r2 <= open*open) {
+          for (int k = 0; k < 8; ++k) {
+            if (node.child[k] >= 0) {
+              stack[top++] = node.child[k];
+            }
+          }
+          continue;
+        }
+
+        // Far enough away: treat the cell as a point mass.
+        float d = sqrt(r2) + eps;
+        float s = G*node.mass/(d*d*d);
+        axi += s*dx;
+        ayi += s*dy;
+        azi += s*dz;
+        ++interactions;
+        continue;
+      }
+
+      // Leaf: direct sum over its particles.
+      interactions += node.end - node.begin;
+      for (size_t k = node.begin; k < node.end; ++k) {
+        size_t j = index[k];
+        if (j != i) {
+          float ddx = px[j] - xi;
+          float ddy = py[j] - yi;
+          float ddz = pz[j] - zi;
+
+          float d = sqrt(ddx*ddx + ddy*ddy + ddz*ddz) + eps;
+          float s = G*mass[j]/(d*d*d);
+          axi += s*ddx;
+          ayi += s*ddy;
+          azi += s*ddz;
+        }
+      }
+    }
+
+    a.ax[i] = axi;
+    a.ay[i] = ayi;
+    a.az[i] = azi;
+    if (a.work) {
+      a.work[i] = interactions;
+    }
+  }
+}
+
+void
+bh_accelerations(const bh_tree &tree, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float theta,
+  unsigned *work, ws_pool *pool)
+{
+  if (tree.nodes.empty()) {
+    return;
+  }
+
+  bh_walk_args args = {&tree.nodes[0], &tree.index[0], px, py, pz, mass,
+    ax, ay, az, G, eps, 1.0f/theta, work};
+  if (pool) {
+    ws_for(*pool, npart, BH_WALK_GRAIN, walk, &args);
+    return;
+  }
+  #pragma omp parallel for schedule(runtime)
+  for (size_t i = 0; i < npart; ++i) {
+    walk(&args, i, i + 1);
+  }
+}
@@ -0,0 +1,59 @@
+/* Barnes-Hut octree used as an O(N log N) alternative to the direct sum. */
+#ifndef BARNES_HUT_H_INCLUDED
+#define BARNES_HUT_H_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+
+#include "worksteal.h"
+
+// Maximum number of particles kept in a leaf before it is split.
+#define BH_LEAF_SIZE 8
+// Maximum depth of the octree; deeper cells are kept as (large) leaves.
+#define BH_MAX_DEPTH 32
+// Subtrees per worker handed to the work-stealing pool by a parallel build.
+#define BH_SUBTREES_PER_WORKER 8
+// Particles per range of a work-stealing tree walk.
+#define BH_WALK_GRAIN 16
+
+/*
+* A single octree cell. Particles of the cell are index[begin..end) of the
+* owning tree; child[k] is -1 when octant k is empty.
+*/
+struct bh_node {
+  float cx, cy, cz;   // Geometric centre of the cell.
+  float half;         // Half of the cell side length.
+  float mx, my, mz;   // Centre of mass.
+  float mass;         // Total mass.
+  size_t begin, end;  // Range of particle indices in the cell.
+  int child[8];       // Indices of child cells, -1 if empty.
+  int leaf;           // 1 if the cell has no children.
+};
+
+struct bh_tree {
+  std::vector<bh_node> nodes;   // nodes[0] is the root.
+  std::vector<size_t> index;    // Particle indices, grouped by cell.
+};
+
+/*
+* Build the octree of particles 0..npart-1. With a pool, the cells down to
+* about npart/(BH_SUBTREES_PER_WORKER*workers) particles are built first and
+* the subtrees below them are built as stolen tasks; the tree is the same.
+*/
+extern void bh_build(bh_tree &tree, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  size_t leaf_size = BH_LEAF_SIZE, ws_pool *pool = NULL);
+
+/*
+* Accelerations of particles 0..npart-1. The tree may hold more particles
+* than npart, which then act as sources only. If work is given, work[i] is
+* set to the number of cells and particles that acted on particle i. With a
+* pool, the walks are spread over its workers in ranges of BH_WALK_GRAIN;
+* otherwise they run as an OpenMP loop with the runtime schedule.
+*/
+extern void bh_accelerations(const bh_tree &tree, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float theta,
+  unsigned *work = NULL, ws_pool *pool = NULL);
+
+#endif // BARNES_HUT_H_INCLUDED
@@ -0,0 +1,105 @@
+/**
+* Hierarchical block time-steps.
+*
+* A step of dt is split into 2^(levels-1) sub-steps. A particle in bin k is
+* active on every 2^(levels-1-k)-th sub-step, so steps of all bins stay
+* nested and synchronised at the end of dt. A particle may move to a finer
+* bin whenever it is active, but to a coarser one only at a time where that
+* bin's steps start.
+*/
+
+#include <math.h>
+
+#include "blocksteps.h"
+#include "direct.h"
+
+void
+block_init(block_state &state, size_t npart, int levels)
+{
+  state.levels = levels;
+  state.bin.assign(npart, 0);
+  state.tick.assign(npart, 0);
+  state.active.reserve(npart);
+  state.qx.resize(npart);
+  state.qy.resize(npart);
+  state.qz.resize(npart);
+  state.evals.assign(levels, 0);
+}
+
+int
+block_step(block_state &state, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  float *ax, float *ay, float *az, const float *mass, float G, float eps,
+  float dt, float eta)
+{
+  int levels = state.levels;
+  unsigned long nsub = 1ul << (levels - 1);
+  float tick_dt = dt/nsub;
+  int *bin = &state.bin[0];
+  unsigned long *tick = &state.tick[0];
+  float *qx = &state.qx[0];
+  float *qy = &state.qy[0];
+  float *qz = &state.qz[0];
+  int passes = 0;
+
+  for (unsigned long t = 0; t < nsub; ++t) {
+    state.active.clear();
+    for (size_t i = 0; i < npart; ++i) {
+      if (tick[i] == t) {
+        state.active.push_back(i);
+      }
+    }
+    if (state.active.empty()) {
+      continue;
+    }
+
+    // Drift every particle from its own time to t along its velocity.
+    // Inactive particles are ahead of t, active ones are exactly at t.
+    #pragma omp parallel for schedule(static)
+    for (size_t j = 0; j < npart; ++j) {
+      float back = ((float) t - (float) tick[j])*tick_dt;
+      qx[j] = px[j] + vx[j]*back;
+      qy[j] = py[j] + vy[j]*back;
+      qz[j] = pz[j] + vz[j]*back;
+    }
+
+    size_t nactive = state.active.size();
+    const size_t *active = &state.active[0];
+    direct_active_accelerations(nactive, active, npart, qx, qy, qz, mass,
+      ax, ay, az, G, eps);
+    ++passes;
+
+    for (size_t k = 0; k < nactive; ++k) {
+      size_t i = active[k];
+
+      float a = sqrt(ax[i]*ax[i] + ay[i]*ay[i] + az[i]*az[i]);
+      float want = a > 0 ? sqrt(2.0f*eta*eps/a) : dt;
+      int b = 0;
+      while (b < levels - 1 && dt/(1ul << b) > want) {
+        ++b;
+      }
+      while (b < bin[i] && t % (nsub >> b) != 0) {
+        ++b;
+      }
+
+      float h = (nsub >> b)*tick_dt;
+      vx[i] += ax[i]*h;
+      vy[i] += ay[i]*h;
+      vz[i] += az[i]*h;
+
+      px[i] += vx[i]*h;
+      py[i] += vy[i]*h;
+      pz[i] += vz[i]*h;
+
+      bin[i] = b;
+      tick[i] += nsub >> b;
+      ++state.evals[b];
+    }
+  }
+
+  // Everyone has reached the end of dt.
+  for (size_t i = 0; i < npart; ++i) {
+    tick[i] = 0;
+  }
+  return passes;
+}
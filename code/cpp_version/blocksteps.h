@@ -0,0 +1,48 @@
+/* Hierarchical power-of-two block time-steps. */
+#ifndef BLOCKSTEPS_H_INCLUDED
+#define BLOCKSTEPS_H_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+
+// Largest number of step bins (the finest step is delta_t/2^(levels-1)).
+#define BLOCK_MAX_LEVELS 24
+
+/*
+* Each particle advances with its own step delta_t/2^bin. Times are counted
+* in ticks of the finest step, delta_t/2^(levels-1), from the start of the
+* current delta_t; tick[i] is the time particle i has been advanced to.
+*/
+struct block_state {
+  int levels;                     // Number of bins.
+  std::vector<int> bin;           // Step bin of each particle.
+  std::vector<unsigned long> tick; // Time of each particle, in ticks.
+  std::vector<size_t> active;     // Particles active on the current sub-step.
+  std::vector<float> qx;          // Positions predicted to the current time.
+  std::vector<float> qy;
+  std::vector<float> qz;
+  std::vector<size_t> evals;      // Force evaluations per bin.
+};
+
+/*
+* Put all npart particles in bin 0 at time 0.
+*/
+extern void block_init(block_state &state, size_t npart, int levels);
+
+/*
+* Advance every particle by dt. On each sub-step only the particles whose
+* step starts there get a new acceleration, from a direct sum over all
+* particles drifted to the current time. Each of them then picks the bin
+* whose step is the largest power-of-two fraction of dt not exceeding
+* sqrt(2*eta*eps/|a|), and is kicked and drifted with it as in
+* update_particle_details(). With a single bin this is exactly the global
+* step.
+* @return The number of force passes, one per sub-step with active
+* particles.
+*/
+extern int block_step(block_state &state, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  float *ax, float *ay, float *az, const float *mass, float G, float eps,
+  float dt, float eta);
+
+#endif // BLOCKSTEPS_H_INCLUDED
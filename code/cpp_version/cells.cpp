@@ -0,0 +1,465 @@
+/**
+* Linked cell lists.
+*
+* The grid is rebuilt from scratch every step with a counting sort: each
+* thread histograms the cells of its share of the particles, the per-thread
+* counts are turned into write offsets with a prefix sum, and each thread
+* then scatters its particles to their slots. The scatter uses the same
+* static partition as the histogram, so the order within a cell is the
+* particle order and the result does not depend on the thread count.
+*
+* Verlet lists are built from such a grid with cells rcut + skin wide and
+* then reused, so between builds each step only gathers over a compact list.
+*
+* The force and list passes are written as bodies over a range of cells or
+* particles, run either by an OpenMP dynamic loop or by the work-stealing
+* pool.
+*/
+
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "cells.h"
+
+static int
+cells_per_axis(float extent, float rcut, int cap)
+{
+  int n = rcut > 0 ? (int) floorf(extent/rcut) : cap;
+  return n < 1 ? 1 : n > cap ? cap : n;
+}
+
+void
+cell_list_build(cell_list &cells, size_t npart,
+  const float *px, const float *py, const float *pz, float rcut)
+{
+  if (npart == 0) {
+    // One empty cell, so the passes over the grid have nothing to do.
+    for (int d = 0; d < 3; ++d) {
+      cells.lo[d] = 0;
+      cells.size[d] = 1;
+      cells.n[d] = 1;
+    }
+    cells.start.assign(2, 0);
+    cells.index.clear();
+    cells.cell.clear();
+    return;
+  }
+
+  // The grid spans the particles' bounding box rather than the nominal
+  // size_x/y/z box: particles leave that box as the run goes on, and the
+  // box also drops the cells no particle can reach.
+  float lo[3] = {px[0], py[0], pz[0]};
+  float hi[3] = {px[0], py[0], pz[0]};
+  for (size_t i = 1; i < npart; ++i) {
+    lo[0] = fminf(lo[0], px[i]); hi[0] = fmaxf(hi[0], px[i]);
+    lo[1] = fminf(lo[1], py[i]); hi[1] = fmaxf(hi[1], py[i]);
+    lo[2] = fminf(lo[2], pz[i]); hi[2] = fmaxf(hi[2], pz[i]);
+  }
+
+  // Cells at least rcut wide, shrinking the grid uniformly when it would
+  // exceed CELLS_PER_PARTICLE cells per particle.
+  size_t max_cells = CELLS_PER_PARTICLE*npart + 1;
+  int cap = 1024;
+  for (;;) {
+    for (int d = 0; d < 3; ++d) {
+      cells.n[d] = cells_per_axis(hi[d] - lo[d], rcut, cap);
+    }
+    if ((size_t) cells.n[0]*cells.n[1]*cells.n[2] <= max_cells || cap == 1) {
+      break;
+    }
+    cap = cells.n[0] > cells.n[1] ? cells.n[0] : cells.n[1];
+    cap = (cells.n[2] > cap ? cells.n[2] : cap)*3/4;
+  }
+  for (int d = 0; d < 3; ++d) {
+    cells.lo[d] = lo[d];
+    // Widen by a hair so the particle on the upper edge falls inside.
+    cells.size[d] = fmaxf((hi[d] - lo[d])*1.000001f, 1e-30f)/cells.n[d];
+  }
+
+  int nx = cells.n[0], ny = cells.n[1], nz = cells.n[2];
+  size_t ncells = (size_t) nx*ny*nz;
+  cells.start.assign(ncells + 1, 0);
+  cells.index.resize(npart);
+  cells.cell.resize(npart);
+
+  size_t *start = &cells.start[0];
+  size_t *index = &cells.index[0];
+  size_t *cell = &cells.cell[0];
+  float inv[3] = {1/cells.size[0], 1/cells.size[1], 1/cells.size[2]};
+
+  #pragma omp parallel
+  {
+#ifdef _OPENMP
+    int nthreads = omp_get_num_threads();
+    int t = omp_get_thread_num();
+#else
+    int nthreads = 1;
+    int t = 0;
+#endif
+
+    #pragma omp single
+    cells.counts.assign((size_t) nthreads*ncells, 0);
+
+    size_t *counts = &cells.counts[(size_t) t*ncells];
+
+    #pragma omp for schedule(static)
+    for (size_t i = 0; i < npart; ++i) {
+      int ix = (int) ((px[i] - lo[0])*inv[0]);
+      int iy = (int) ((py[i] - lo[1])*inv[1]);
+      int iz = (int) ((pz[i] - lo[2])*inv[2]);
+      ix = ix < 0 ? 0 : ix >= nx ? nx - 1 : ix;
+      iy = iy < 0 ? 0 : iy >= ny ? ny - 1 : iy;
+      iz = iz < 0 ? 0 : iz >= nz ? nz - 1 : iz;
+      size_t c = ((size_t) ix*ny + iy)*nz + iz;
+      cell[i] = c;
+      ++counts[c];
+    }
+
+    // Offsets of each thread within each cell; start[c + 1] gets the size.
+    #pragma omp for schedule(static)
+    for (size_t c = 0; c < ncells; ++c) {
+      size_t total = 0;
+      for (int k = 0; k < nthreads; ++k) {
+        size_t count = cells.counts[(size_t) k*ncells + c];
+        cells.counts[(size_t) k*ncells + c] = total;
+        total += count;
+      }
+      start[c + 1] = total;
+    }
+
+    #pragma omp single
+    for (size_t c = 0; c < ncells; ++c) {
+      start[c + 1] += start[c];
+    }
+
+    #pragma omp for schedule(static)
+    for (size_t i = 0; i < npart; ++i) {
+      size_t c = cell[i];
+      index[start[c] + counts[c]++] = i;
+    }
+  }
+}
+
+// Data of a force or list pass, shared by its ranges.
+struct cell_pass {
+  const cell_list *cells;
+  const size_t *start;          // Start of each particle's list.
+  const size_t *neigh;          // Neighbour lists being read.
+  size_t *count;                // Neighbour counts being written.
+  size_t *out;                  // Neighbour lists being written.
+  const float *px, *py, *pz, *mass;
+  float *ax, *ay, *az;
+  float G, eps, r2;
+};
+
+/*
+* Cutoff accelerations of the particles in cells begin..end-1, with
+* softening kernel K.
+*/
+template <class K>
+static void
+cutoff_cells(void *ctx, size_t begin, size_t end)
+{
+  const cell_pass &p = *(const cell_pass *) ctx;
+  const cell_list &cells = *p.cells;
+  int nx = cells.n[0], ny = cells.n[1], nz = cells.n[2];
+  const size_t *start = &cells.start[0];
+  const size_t *index = &cells.index[0];
+  const float *px = p.px, *py = p.py, *pz = p.pz, *mass = p.mass;
+  float G = p.G, eps = p.eps, rcut2 = p.r2;
+
+  for (size_t c = begin; c < end; ++c) {
+    int ix = (int) (c/((size_t) ny*nz));
+    int iy = (int) (c/nz%ny);
+    int iz = (int) (c%nz);
+
+    for (size_t k = start[c]; k < start[c + 1]; ++k) {
+      size_t i = index[k];
+      float xi = px[i];
+      float yi = py[i];
+      float zi = pz[i];
+
+      float axi = 0.0, ayi = 0.0, azi = 0.0;
+
+      for (int jx = ix - 1; jx <= ix + 1; ++jx) {
+        if (jx < 0 || jx >= nx) {
+          continue;
+        }
+        for (int jy = iy - 1; jy <= iy + 1; ++jy) {
+          if (jy < 0 || jy >= ny) {
+            continue;
+          }
+          for (int jz = iz - 1; jz <= iz + 1; ++jz) {
+            if (jz < 0 || jz >= nz) {
+              continue;
+            }
+            size_t b = ((size_t) jx*ny + jy)*nz + jz;
+
+            for (size_t l = start[b]; l < start[b + 1]; ++l) {
+              size_t j = index[l];
+              float dx = px[j] - xi;
+              float dy = py[j] - yi;
+              float dz = pz[j] - zi;
+              float r2 = dx*dx + dy*dy + dz*dz;
+
+              if (j != i && r2 < rcut2) {
+                float s = G*mass[j]*K::factor(r2, eps);
+                axi += s*dx;
+                ayi += s*dy;
+                azi += s*dz;
+              }
+            }
+          }
+        }
+      }
+
+      p.ax[i] = axi;
+      p.ay[i] = ayi;
+      p.az[i] = azi;
+    }
+  }
+}
+
+/*
+* Instance of a pass template for a SOFT_* kernel.
+*/
+template <template <class> class Pass>
+static ws_body
+softened(int softening)
+{
+  switch (softening) {
+    case SOFT_PLUMMER:
+      return Pass<soft_plummer>::run;
+    case SOFT_SPLINE:
+      return Pass<soft_spline>::run;
+    case SOFT_NONE:
+      return Pass<soft_none>::run;
+    default:
+      return Pass<soft_legacy>::run;
+  }
+}
+
+template <class K>
+struct cutoff_pass {
+  static void run(void *ctx, size_t begin, size_t end)
+  {
+    cutoff_cells<K>(ctx, begin, end);
+  }
+};
+
+void
+cutoff_accelerations(const cell_list &cells,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float rcut,
+  ws_pool *pool, int softening)
+{
+  size_t ncells = (size_t) cells.n[0]*cells.n[1]*cells.n[2];
+  ws_body body = softened<cutoff_pass>(softening);
+  cell_pass p = {&cells, NULL, NULL, NULL, NULL, px, py, pz, mass,
+    ax, ay, az, G, eps, rcut*rcut};
+
+  // Particles are visited cell by cell, so neighbouring i-particles share
+  // the same 27 cells of j-particles in cache.
+  if (pool) {
+    ws_for(*pool, ncells, CELLS_STEAL_GRAIN, body, &p);
+    return;
+  }
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (size_t c = 0; c < ncells; ++c) {
+    body(&p, c, c + 1);
+  }
+}
+
+/*
+* Append to out (when given) the particles other than i within sqrt(r2max)
+* of (xi, yi, zi), visiting the 27 cells around cell c.
+* @return The number of such particles.
+*/
+static size_t
+gather_neighbours(const cell_list &cells, size_t c, size_t i,
+  float xi, float yi, float zi, const float *px, const float *py,
+  const float *pz, float r2max, size_t *out)
+{
+  int nx = cells.n[0], ny = cells.n[1], nz = cells.n[2];
+  int ix = (int) (c/((size_t) ny*nz));
+  int iy = (int) (c/nz%ny);
+  int iz = (int) (c%nz);
+  const size_t *start = &cells.start[0];
+  const size_t *index = &cells.index[0];
+  size_t count = 0;
+
+  for (int jx = ix - 1; jx <= ix + 1; ++jx) {
+    if (jx < 0 || jx >= nx) {
+      continue;
+    }
+    for (int jy = iy - 1; jy <= iy + 1; ++jy) {
+      if (jy < 0 || jy >= ny) {
+        continue;
+      }
+      for (int jz = iz - 1; jz <= iz + 1; ++jz) {
+        if (jz < 0 || jz >= nz) {
+          continue;
+        }
+        size_t b = ((size_t) jx*ny + jy)*nz + jz;
+
+        for (size_t l = start[b]; l < start[b + 1]; ++l) {
+          size_t j = index[l];
+          float dx = px[j] - xi;
+          float dy = py[j] - yi;
+          float dz = pz[j] - zi;
+
+          if (j != i && dx*dx + dy*dy + dz*dz < r2max) {
+            if (out) {
+              out[count] = j;
+            }
+            ++count;
+          }
+        }
+      }
+    }
+  }
+
+  return count;
+}
+
+// Neighbour counts of particles begin..end-1, into count[i + 1].
+static void
+count_neighbours(void *ctx, size_t begin, size_t end)
+{
+  const cell_pass &p = *(const cell_pass *) ctx;
+  const size_t *cell = &p.cells->cell[0];
+  for (size_t i = begin; i < end; ++i) {
+    p.count[i + 1] = gather_neighbours(*p.cells, cell[i], i,
+      p.px[i], p.py[i], p.pz[i], p.px, p.py, p.pz, p.r2, NULL);
+  }
+}
+
+// Neighbour lists of particles begin..end-1, at neigh + start[i].
+static void
+fill_neighbours(void *ctx, size_t begin, size_t end)
+{
+  const cell_pass &p = *(const cell_pass *) ctx;
+  const size_t *cell = &p.cells->cell[0];
+  for (size_t i = begin; i < end; ++i) {
+    gather_neighbours(*p.cells, cell[i], i, p.px[i], p.py[i], p.pz[i],
+      p.px, p.py, p.pz, p.r2, p.out + p.start[i]);
+  }
+}
+
+void
+verlet_build(verlet_list &list, const cell_list &cells, size_t npart,
+  const float *px, const float *py, const float *pz, float rlist,
+  ws_pool *pool)
+{
+  float r2max = rlist*rlist;
+  list.rlist = rlist;
+  list.start.assign(npart + 1, 0);
+  list.disp_x.assign(npart, 0);
+  list.disp_y.assign(npart, 0);
+  list.disp_z.assign(npart, 0);
+  ++list.builds;
+
+  size_t *start = &list.start[0];
+  cell_pass p = {&cells, start, NULL, start, NULL, px, py, pz, NULL,
+    NULL, NULL, NULL, 0, 0, r2max};
+
+  // Count, then fill: the lists are laid out contiguously in particle order.
+  if (pool) {
+    ws_for(*pool, npart, VERLET_STEAL_GRAIN, count_neighbours, &p);
+  } else {
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t i = 0; i < npart; ++i) {
+      count_neighbours(&p, i, i + 1);
+    }
+  }
+
+  for (size_t i = 0; i < npart; ++i) {
+    start[i + 1] += start[i];
+  }
+  list.neigh.resize(start[npart]);
+  p.out = list.neigh.empty() ? NULL : &list.neigh[0];
+
+  if (pool) {
+    ws_for(*pool, npart, VERLET_STEAL_GRAIN, fill_neighbours, &p);
+  } else {
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (size_t i = 0; i < npart; ++i) {
+      fill_neighbours(&p, i, i + 1);
+    }
+  }
+}
+
+/*
+* Accelerations of particles begin..end-1 over their neighbour lists, with
+* softening kernel K. The lists never hold i itself.
+*/
+template <class K>
+static void
+verlet_gather(void *ctx, size_t begin, size_t end)
+{
+  const cell_pass &p = *(const cell_pass *) ctx;
+  const size_t *start = p.start;
+  const size_t *neigh = p.neigh;
+  const float *px = p.px, *py = p.py, *pz = p.pz, *mass = p.mass;
+  float G = p.G, eps = p.eps, rcut2 = p.r2;
+
+  for (size_t i = begin; i < end; ++i) {
+    float xi = px[i];
+    float yi = py[i];
+    float zi = pz[i];
+
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+
+    for (size_t k = start[i]; k < start[i + 1]; ++k) {
+      size_t j = neigh[k];
+      float dx = px[j] - xi;
+      float dy = py[j] - yi;
+      float dz = pz[j] - zi;
+      float r2 = dx*dx + dy*dy + dz*dz;
+
+      // The list also holds particles in the skin, beyond rcut.
+      if (r2 < rcut2) {
+        float s = G*mass[j]*K::factor(r2, eps);
+        axi += s*dx;
+        ayi += s*dy;
+        azi += s*dz;
+      }
+    }
+
+    p.ax[i] = axi;
+    p.ay[i] = ayi;
+    p.az[i] = azi;
+  }
+}
+
+template <class K>
+struct verlet_pass {
+  static void run(void *ctx, size_t begin, size_t end)
+  {
+    verlet_gather<K>(ctx, begin, end);
+  }
+};
+
+void
+verlet_accelerations(const verlet_list &list, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float rcut,
+  ws_pool *pool, int softening)
+{
+  ws_body body = softened<verlet_pass>(softening);
+  cell_pass p = {NULL, &list.start[0],
+    list.neigh.empty() ? NULL : &list.neigh[0], NULL, NULL, px, py, pz, mass,
+    ax, ay, az, G, eps, rcut*rcut};
+
+  if (pool) {
+    ws_for(*pool, npart, VERLET_STEAL_GRAIN, body, &p);
+    return;
+  }
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (size_t i = 0; i < npart; ++i) {
+    body(&p, i, i + 1);
+  }
+}
@@ -0,0 +1,85 @@
+/* Linked cell lists for cutoff-radius (short-range) interactions. */
+#ifndef CELLS_H_INCLUDED
+#define CELLS_H_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+
+#include "softening.h"
+#include "worksteal.h"
+
+// Upper bound on the number of cells per particle, to bound memory and the
+// cost of visiting empty cells when the cutoff is small.
+#define CELLS_PER_PARTICLE 2
+// Cells per range of a work-stealing cutoff pass.
+#define CELLS_STEAL_GRAIN 16
+// Particles per range of a work-stealing Verlet list pass.
+#define VERLET_STEAL_GRAIN 64
+
+/*
+* Particles binned into a uniform grid of cells at least rcut wide, so all
+* neighbours within rcut lie in the 27 cells around a particle's own cell.
+* The particles of cell c are index[start[c]..start[c+1]).
+*/
+struct cell_list {
+  float lo[3];                  // Lower corner of the grid.
+  float size[3];                // Cell side lengths.
+  int n[3];                     // Cells per axis.
+  std::vector<size_t> start;    // First entry of each cell in index.
+  std::vector<size_t> index;    // Particle indices, grouped by cell.
+  std::vector<size_t> cell;     // Cell of each particle.
+  std::vector<size_t> counts;   // Per-thread histograms used by the build.
+};
+
+/*
+* Bin the particles with a parallel counting sort. The grid spans the
+* particles' bounding box; with no particles it is a single empty cell.
+*/
+extern void cell_list_build(cell_list &cells, size_t npart,
+  const float *px, const float *py, const float *pz, float rcut);
+
+/*
+* Accelerations from the force with softening kernel softening (a SOFT_*
+* value) truncated at rcut, visiting only the 27 cells around each particle.
+* With a pool, ranges of cells are spread over its workers instead of an
+* OpenMP dynamic loop.
+*/
+extern void cutoff_accelerations(const cell_list &cells,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float rcut,
+  ws_pool *pool = NULL, int softening = SOFT_LEGACY);
+
+/*
+* Per-particle neighbour lists: the neighbours of particle i that were within
+* rlist = rcut + skin at the last build are neigh[start[i]..start[i+1]).
+* The lists stay valid until some particle has moved more than skin/2, which
+* the integrator tracks in disp_x/disp_y/disp_z.
+*/
+struct verlet_list {
+  float rlist;                  // Radius the lists were built with.
+  std::vector<size_t> start;    // First entry of each particle in neigh.
+  std::vector<size_t> neigh;    // Neighbour indices, grouped by particle.
+  std::vector<float> disp_x;    // Displacement since the last build.
+  std::vector<float> disp_y;
+  std::vector<float> disp_z;
+  size_t builds;                // Number of builds so far.
+};
+
+/*
+* Rebuild the neighbour lists from cells binned with a cutoff of at least
+* rlist, and reset the displacements to zero.
+*/
+extern void verlet_build(verlet_list &list, const cell_list &cells,
+  size_t npart, const float *px, const float *py, const float *pz,
+  float rlist, ws_pool *pool = NULL);
+
+/*
+* As cutoff_accelerations(), gathered over the neighbour lists. Requires
+* rcut <= list.rlist.
+*/
+extern void verlet_accelerations(const verlet_list &list, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float rcut,
+  ws_pool *pool = NULL, int softening = SOFT_LEGACY);
+
+#endif // CELLS_H_INCLUDED
@@ -0,0 +1,70 @@
+#!/bin/bash
+# Accuracy checks run by "make check": every force mode against the double
+# precision direct sum (force_check=), and every integrator on the relative
+# energy error after a few steps (energy_check=1). The tolerances are a few
+# times the errors measured on the fixed setup below, and for the direct
+# kernels they are the accuracy tiers quoted in direct.h, fmm.h and pm.h.
+
+prog=${1:-./particles_omp}
+common="npart=2000 nsteps=2 force_check=100"
+failed=0
+
+# Usage: check_force name rms_tol max_tol args...
+check_force() {
+  local name=$1 rms_tol=$2 max_tol=$3
+  shift 3
+  local line
+  line=$($prog $common "$@" | grep "force_error_vs_direct")
+  local rms=$(echo "$line" | sed -n 's/.*rms=\([^ ]*\).*/\1/p')
+  local max=$(echo "$line" | sed -n 's/.*max=\([^ ]*\).*/\1/p')
+  if [ -n "$rms" ] && awk "BEGIN { exit !($rms <= $rms_tol && $max <= $max_tol) }"; then
+    echo "PASS force $name rms=$rms max=$max"
+  else
+    echo "FAIL force $name rms=$rms (<= $rms_tol) max=$max (<= $max_tol)"
+    failed=1
+  fi
+}
+
+# Usage: check_energy name tol args...
+check_energy() {
+  local name=$1 tol=$2
+  shift 2
+  local err
+  err=$($prog npart=1000 nsteps=4 energy_check=1 "$@" \
+    | sed -n 's/^energy_error=\([^ ]*\).*/\1/p')
+  if [ -n "$err" ] && awk "BEGIN { exit !($err <= $tol) }"; then
+    echo "PASS energy $name error=$err"
+  else
+    echo "FAIL energy $name error=$err (<= $tol)"
+    failed=1
+  fi
+}
+
+check_force direct_sym      2e-6 1e-5 force=direct_sym
+check_force direct_blocked  1e-6 5e-6 force=direct_blocked
+check_force direct_simd_nr0 2e-4 2e-3 force=direct_simd simd_nr=0
+check_force direct_simd_nr1 1e-6 5e-6 force=direct_simd simd_nr=1
+check_force direct_mixed    2e-6 2e-5 force=direct_mixed
+check_force bh              5e-3 2e-2 force=bh
+check_force fmm             5e-4 3e-3 force=fmm
+check_force pm              0.5  4    force=pm
+check_force treepm          1.5e-2 4e-2 force=treepm
+check_force p3m             1.5e-2 4e-2 force=p3m
+# With a cutoff beyond the box the truncated sums are the full direct sum.
+check_force cutoff          2e-6 1e-5 force=cutoff rcut=100000
+check_force verlet          2e-6 1e-5 force=verlet rcut=100000
+check_force plummer         1e-6 5e-6 force=direct_blocked softening=plummer
+check_force spline          1e-6 5e-6 force=direct_blocked softening=spline
+
+check_energy euler          5e-5 integrator=euler
+check_energy kdk            3e-7 integrator=kdk
+check_energy yoshida        1e-9 integrator=yoshida
+check_energy hermite        2e-8 integrator=hermite
+check_energy respa          3e-7 respa=2
+check_energy block_levels   5e-5 block_levels=3
+check_energy adaptive       5e-5 t_end=400 dt_eta=0.1
+check_energy parareal       5e-5 parareal=2
+check_energy kdk_plummer    3e-6 integrator=kdk softening=plummer
+check_energy kdk_spline     3e-6 integrator=kdk softening=spline
+
+exit $failed
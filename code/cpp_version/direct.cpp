@@ -0,0 +1,500 @@
+/**
+* Alternative kernels for the exact all-pairs sum. All of them use the same
+* eps-softened force law as update_particle_details().
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <math.h>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "direct.h"
+
+/*
+* Interactions between the particles of tiles ti and tj, each evaluated once.
+*/
+static void
+tile_pair(size_t ti, size_t tj, size_t tile, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps)
+{
+  size_t iend = (ti + 1)*tile < npart ? (ti + 1)*tile : npart;
+  size_t jend = (tj + 1)*tile < npart ? (tj + 1)*tile : npart;
+
+  for (size_t i = ti*tile; i < iend; ++i) {
+    float xi = px[i];
+    float yi = py[i];
+    float zi = pz[i];
+    float mi = mass[i];
+
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+
+    for (size_t j = (ti == tj ? i + 1 : tj*tile); j < jend; ++j) {
+      float dx = px[j] - xi;
+      float dy = py[j] - yi;
+      float dz = pz[j] - zi;
+
+      float d = sqrt(dx*dx + dy*dy + dz*dz) + eps;
+      float s = G/(d*d*d);
+
+      // Equal and opposite accelerations, scaled by the other mass.
+      float sj = s*mass[j];
+      axi += sj*dx;
+      ayi += sj*dy;
+      azi += sj*dz;
+
+      float si = s*mi;
+      ax[j] -= si*dx;
+      ay[j] -= si*dy;
+      az[j] -= si*dz;
+    }
+
+    ax[i] += axi;
+    ay[i] += ayi;
+    az[i] += azi;
+  }
+}
+
+void
+direct_symmetric_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, size_t tile)
+{
+  size_t ntiles = (npart + tile - 1)/tile;
+
+  // Round-robin ("circle method") schedule over an even number of tiles; a
+  // tile index >= ntiles is a bye.
+  size_t m = ntiles + (ntiles & 1);
+
+  #pragma omp parallel
+  {
+    #pragma omp for schedule(static)
+    for (size_t i = 0; i < npart; ++i) {
+      ax[i] = 0.0;
+      ay[i] = 0.0;
+      az[i] = 0.0;
+    }
+
+    // Diagonal tiles touch disjoint particles.
+    #pragma omp for schedule(dynamic)
+    for (size_t t = 0; t < ntiles; ++t) {
+      tile_pair(t, t, tile, npart, px, py, pz, mass, ax, ay, az, G, eps);
+    }
+
+    // Each round pairs every tile with exactly one other, so the pairs of a
+    // round can run concurrently; the barrier at the end of each loop keeps
+    // rounds apart.
+    for (size_t r = 0; r + 1 < m; ++r) {
+      #pragma omp for schedule(dynamic)
+      for (size_t k = 0; k < m/2; ++k) {
+        size_t a, b;
+        if (k == 0) {
+          a = r;
+          b = m - 1;
+        } else {
+          a = (r + k) % (m - 1);
+          b = (r + m - 1 - k) % (m - 1);
+        }
+        if (a < ntiles && b < ntiles) {
+          tile_pair(a, b, tile, npart, px, py, pz, mass, ax, ay, az, G, eps);
+        }
+      }
+    }
+  }
+}
+
+// register_tile() holds exactly four i-particles in named registers.
+static_assert(DIRECT_REG_TILE == 4, "register_tile() is written for 4 lanes");
+
+/*
+* Accumulate the accelerations of i-particles i..i+DIRECT_REG_TILE-1 due to
+* j-particles jb..jend-1 with softening kernel K. Only the first nr
+* i-particles are stored.
+*/
+template <class K>
+static inline void
+register_tile(size_t i, size_t nr, size_t jb, size_t jend,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps)
+{
+  // Pad short groups by repeating particle i; the padded results are dropped.
+  float x0 = px[i], y0 = py[i], z0 = pz[i];
+  float x1 = px[i + (nr > 1 ? 1 : 0)], y1 = py[i + (nr > 1 ? 1 : 0)];
+  float z1 = pz[i + (nr > 1 ? 1 : 0)];
+  float x2 = px[i + (nr > 2 ? 2 : 0)], y2 = py[i + (nr > 2 ? 2 : 0)];
+  float z2 = pz[i + (nr > 2 ? 2 : 0)];
+  float x3 = px[i + (nr > 3 ? 3 : 0)], y3 = py[i + (nr > 3 ? 3 : 0)];
+  float z3 = pz[i + (nr > 3 ? 3 : 0)];
+
+  float ax0 = 0, ay0 = 0, az0 = 0, ax1 = 0, ay1 = 0, az1 = 0;
+  float ax2 = 0, ay2 = 0, az2 = 0, ax3 = 0, ay3 = 0, az3 = 0;
+
+  // The j == self test is resolved at compile time; only the unsoftened
+  // kernel needs it.
+#define DIRECT_INTERACT(self, xi, yi, zi, axi, ayi, azi) \
+  { \
+    float dx = xj - xi; \
+    float dy = yj - yi; \
+    float dz = zj - zi; \
+    float s = K::self_check && j == (self) \
+      ? 0.0f : gmj*K::factor(dx*dx + dy*dy + dz*dz, eps); \
+    axi += s*dx; \
+    ayi += s*dy; \
+    azi += s*dz; \
+  }
+
+  #pragma omp simd reduction(+:ax0,ay0,az0,ax1,ay1,az1,ax2,ay2,az2,ax3,ay3,az3)
+  for (size_t j = jb; j < jend; ++j) {
+    float xj = px[j];
+    float yj = py[j];
+    float zj = pz[j];
+    float gmj = G*mass[j];
+
+    DIRECT_INTERACT(i, x0, y0, z0, ax0, ay0, az0)
+    DIRECT_INTERACT(i + (nr > 1 ? 1 : 0), x1, y1, z1, ax1, ay1, az1)
+    DIRECT_INTERACT(i + (nr > 2 ? 2 : 0), x2, y2, z2, ax2, ay2, az2)
+    DIRECT_INTERACT(i + (nr > 3 ? 3 : 0), x3, y3, z3, ax3, ay3, az3)
+  }
+
+#undef DIRECT_INTERACT
+
+  ax[i] += ax0; ay[i] += ay0; az[i] += az0;
+  if (nr > 1) { ax[i + 1] += ax1; ay[i + 1] += ay1; az[i + 1] += az1; }
+  if (nr > 2) { ax[i + 2] += ax2; ay[i + 2] += ay2; az[i + 2] += az2; }
+  if (nr > 3) { ax[i + 3] += ax3; ay[i + 3] += ay3; az[i + 3] += az3; }
+}
+
+/*
+* Blocked sum for the i-particles ibegin..iend-1 against all particles.
+*/
+template <class K>
+static void
+blocked_range(size_t ibegin, size_t iend, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, size_t ti, size_t tj)
+{
+  for (size_t ib = ibegin; ib < iend; ib += ti) {
+    size_t ie = ib + ti < iend ? ib + ti : iend;
+
+    for (size_t i = ib; i < ie; ++i) {
+      ax[i] = 0.0;
+      ay[i] = 0.0;
+      az[i] = 0.0;
+    }
+
+    for (size_t jb = 0; jb < npart; jb += tj) {
+      size_t je = jb + tj < npart ? jb + tj : npart;
+      for (size_t i = ib; i < ie; i += DIRECT_REG_TILE) {
+        size_t nr = ie - i < DIRECT_REG_TILE ? ie - i : DIRECT_REG_TILE;
+        register_tile<K>(i, nr, jb, je, px, py, pz, mass, ax, ay, az, G,
+          eps);
+      }
+    }
+  }
+}
+
+/*
+* Blocked sum for the first ni i-particles, one i-block per iteration of a
+* static OpenMP loop.
+*/
+template <class K>
+static void
+blocked_rows(size_t ni, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, size_t ti, size_t tj)
+{
+  size_t nblocks = (ni + ti - 1)/ti;
+
+  #pragma omp parallel for schedule(static)
+  for (size_t b = 0; b < nblocks; ++b) {
+    size_t ie = (b + 1)*ti < ni ? (b + 1)*ti : ni;
+    blocked_range<K>(b*ti, ie, npart, px, py, pz, mass, ax, ay, az, G, eps,
+      ti, tj);
+  }
+}
+
+/*
+* blocked_rows() with the softening kernel picked at run time.
+*/
+static void
+blocked_rows_softened(int softening, size_t ni, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, size_t ti, size_t tj)
+{
+  switch (softening) {
+    case SOFT_PLUMMER:
+      blocked_rows<soft_plummer>(ni, npart, px, py, pz, mass, ax, ay, az,
+        G, eps, ti, tj);
+      break;
+    case SOFT_SPLINE:
+      blocked_rows<soft_spline>(ni, npart, px, py, pz, mass, ax, ay, az,
+        G, eps, ti, tj);
+      break;
+    case SOFT_NONE:
+      blocked_rows<soft_none>(ni, npart, px, py, pz, mass, ax, ay, az,
+        G, eps, ti, tj);
+      break;
+    default:
+      blocked_rows<soft_legacy>(ni, npart, px, py, pz, mass, ax, ay, az,
+        G, eps, ti, tj);
+  }
+}
+
+void
+direct_blocked_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, size_t ti, size_t tj,
+  int softening)
+{
+  blocked_rows_softened(softening, npart, npart, px, py, pz, mass,
+    ax, ay, az, G, eps, ti, tj);
+}
+
+void
+direct_blocked_autotune(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float G, float eps, size_t *ti, size_t *tj, int softening)
+{
+  static const size_t ti_cand[] = {16, 32, 64, 128, 256};
+  static const size_t tj_cand[] = {256, 512, 1024, 2048, 4096, 8192};
+
+  // Time 256 i-particles per thread against the first DIRECT_TUNE_J
+  // j-particles on the team a full step will use. That is several blocks
+  // of the largest j-tile, so it exercises the same j-footprint and shared
+  // cache pressure as a full step, at a cost independent of npart.
+#ifdef _OPENMP
+  size_t nthreads = omp_get_max_threads();
+#else
+  size_t nthreads = 1;
+#endif
+  size_t ni = npart < 256*nthreads ? npart : 256*nthreads;
+  size_t nj = npart < DIRECT_TUNE_J ? npart : DIRECT_TUNE_J;
+  std::vector<float> bx(ni), by(ni), bz(ni);
+  double best = -1.0;
+
+  for (size_t a = 0; a < sizeof(ti_cand)/sizeof(ti_cand[0]); ++a) {
+    for (size_t b = 0; b < sizeof(tj_cand)/sizeof(tj_cand[0]); ++b) {
+      std::chrono::high_resolution_clock::time_point t1 =
+        std::chrono::high_resolution_clock::now();
+      blocked_rows_softened(softening, ni, nj, px, py, pz, mass,
+        &bx[0], &by[0], &bz[0], G, eps, ti_cand[a], tj_cand[b]);
+      std::chrono::high_resolution_clock::time_point t2 =
+        std::chrono::high_resolution_clock::now();
+
+      double t = std::chrono::duration<double>(t2 - t1).count();
+      if (best < 0 || t < best) {
+        best = t;
+        *ti = ti_cand[a];
+        *tj = tj_cand[b];
+      }
+    }
+  }
+}
+
+/*
+* Spread the low 10 bits of v so that there are two zero bits between each.
+*/
+static unsigned int
+spread_bits(unsigned int v)
+{
+  v &= 0x3ff;
+  v = (v | (v << 16)) & 0x030000ff;
+  v = (v | (v << 8)) & 0x0300f00f;
+  v = (v | (v << 4)) & 0x030c30c3;
+  v = (v | (v << 2)) & 0x09249249;
+  return v;
+}
+
+void
+direct_mixed_accelerations(size_t npart,
+  const double *px, const double *py, const double *pz, const float *mass,
+  double *ax, double *ay, double *az, float G, float eps, size_t tile)
+{
+  if (npart == 0) {
+    return;
+  }
+
+  // Order the particles along a coarse Morton curve so that each tile is
+  // spatially compact and its origin is close to all of its particles.
+  double lo[3] = {px[0], py[0], pz[0]}, hi[3] = {px[0], py[0], pz[0]};
+  for (size_t i = 1; i < npart; ++i) {
+    lo[0] = std::min(lo[0], px[i]); hi[0] = std::max(hi[0], px[i]);
+    lo[1] = std::min(lo[1], py[i]); hi[1] = std::max(hi[1], py[i]);
+    lo[2] = std::min(lo[2], pz[i]); hi[2] = std::max(hi[2], pz[i]);
+  }
+  double scale = 0.0;
+  for (int d = 0; d < 3; ++d) {
+    scale = std::max(scale, hi[d] - lo[d]);
+  }
+  scale = scale > 0.0 ? 1023.0/scale : 0.0;
+
+  std::vector<std::pair<unsigned int, size_t> > keys(npart);
+  for (size_t i = 0; i < npart; ++i) {
+    unsigned int kx = (unsigned int) ((px[i] - lo[0])*scale);
+    unsigned int ky = (unsigned int) ((py[i] - lo[1])*scale);
+    unsigned int kz = (unsigned int) ((pz[i] - lo[2])*scale);
+    keys[i].first = spread_bits(kx) | (spread_bits(ky) << 1)
+      | (spread_bits(kz) << 2);
+    keys[i].second = i;
+  }
+  std::sort(keys.begin(), keys.end());
+
+  size_t ntiles = (npart + tile - 1)/tile;
+
+  #pragma omp parallel
+  {
+    std::vector<float> xi(tile), yi(tile), zi(tile);
+    std::vector<float> xj(tile), yj(tile), zj(tile), gmj(tile);
+    std::vector<double> sx(tile), sy(tile), sz(tile);
+
+    #pragma omp for schedule(static)
+    for (size_t ti = 0; ti < ntiles; ++ti) {
+      size_t ib = ti*tile;
+      size_t ni = ib + tile < npart ? tile : npart - ib;
+
+      // Tile origin.
+      size_t o = keys[ib].second;
+      double ox = px[o], oy = py[o], oz = pz[o];
+      for (size_t k = 0; k < ni; ++k) {
+        size_t i = keys[ib + k].second;
+        xi[k] = (float) (px[i] - ox);
+        yi[k] = (float) (py[i] - oy);
+        zi[k] = (float) (pz[i] - oz);
+        sx[k] = 0.0;
+        sy[k] = 0.0;
+        sz[k] = 0.0;
+      }
+
+      for (size_t jb = 0; jb < npart; jb += tile) {
+        size_t nj = jb + tile < npart ? tile : npart - jb;
+        for (size_t k = 0; k < nj; ++k) {
+          size_t j = keys[jb + k].second;
+          xj[k] = (float) (px[j] - ox);
+          yj[k] = (float) (py[j] - oy);
+          zj[k] = (float) (pz[j] - oz);
+          gmj[k] = G*mass[j];
+        }
+
+        for (size_t k = 0; k < ni; ++k) {
+          float x = xi[k], y = yi[k], z = zi[k];
+          float fx = 0, fy = 0, fz = 0;
+
+          #pragma omp simd reduction(+:fx,fy,fz)
+          for (size_t j = 0; j < nj; ++j) {
+            float dx = xj[j] - x;
+            float dy = yj[j] - y;
+            float dz = zj[j] - z;
+            float d = sqrtf(dx*dx + dy*dy + dz*dz) + eps;
+            float s = gmj[j]/(d*d*d);
+            fx += s*dx;
+            fy += s*dy;
+            fz += s*dz;
+          }
+
+          sx[k] += fx;
+          sy[k] += fy;
+          sz[k] += fz;
+        }
+      }
+
+      for (size_t k = 0; k < ni; ++k) {
+        size_t i = keys[ib + k].second;
+        ax[i] = sx[k];
+        ay[i] = sy[k];
+        az[i] = sz[k];
+      }
+    }
+  }
+}
+
+void
+direct_active_accelerations(size_t nactive, const size_t *active,
+  size_t npart, const float *px, const float *py, const float *pz,
+  const float *mass, float *ax, float *ay, float *az, float G, float eps)
+{
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (size_t k = 0; k < nactive; ++k) {
+    size_t i = active[k];
+    float xi = px[i];
+    float yi = py[i];
+    float zi = pz[i];
+
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+
+    for (size_t j = 0; j < npart; ++j) {
+      float dx = px[j] - xi;
+      float dy = py[j] - yi;
+      float dz = pz[j] - zi;
+
+      // With eps > 0 the particle itself contributes exactly zero.
+      float d = sqrt(dx*dx + dy*dy + dz*dz) + eps;
+      float s = G*mass[j]/(d*d*d);
+      axi += s*dx;
+      ayi += s*dy;
+      azi += s*dz;
+    }
+
+    ax[i] = axi;
+    ay[i] = ayi;
+    az[i] = azi;
+  }
+}
+
+void
+direct_jerk_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz,
+  const float *vx, const float *vy, const float *vz, const float *mass,
+  float *ax, float *ay, float *az, float *jx, float *jy, float *jz,
+  float G, float eps)
+{
+  #pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < npart; ++i) {
+    float xi = px[i];
+    float yi = py[i];
+    float zi = pz[i];
+    float vxi = vx[i];
+    float vyi = vy[i];
+    float vzi = vz[i];
+
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+    float jxi = 0.0, jyi = 0.0, jzi = 0.0;
+
+    #pragma omp simd reduction(+:axi,ayi,azi,jxi,jyi,jzi)
+    for (size_t j = 0; j < npart; ++j) {
+      float dx = px[j] - xi;
+      float dy = py[j] - yi;
+      float dz = pz[j] - zi;
+      float dvx = vx[j] - vxi;
+      float dvy = vy[j] - vyi;
+      float dvz = vz[j] - vzi;
+
+      float r2 = dx*dx + dy*dy + dz*dz;
+      float r = sqrtf(r2);
+      float d = r + eps;
+      float s = G*mass[j]/(d*d*d);
+
+      // (r.v)/|r| is the rate of change of |r|; the self term has r = 0.
+      float rdot = r2 > 0 ? (dx*dvx + dy*dvy + dz*dvz)/r : 0.0f;
+      float t = 3.0f*s*rdot/d;
+
+      axi += s*dx;
+      ayi += s*dy;
+      azi += s*dz;
+      jxi += s*dvx - t*dx;
+      jyi += s*dvy - t*dy;
+      jzi += s*dvz - t*dz;
+    }
+
+    ax[i] = axi;
+    ay[i] = ayi;
+    az[i] = azi;
+    jx[i] = jxi;
+    jy[i] = jyi;
+    jz[i] = jzi;
+  }
+}
@@ -0,0 +1,118 @@
+/* Alternative kernels for the exact all-pairs (direct) sum. */
+#ifndef DIRECT_H_INCLUDED
+#define DIRECT_H_INCLUDED
+
+#include <stddef.h>
+
+#include "softening.h"
+
+// Particles per tile of the symmetric kernel.
+#define DIRECT_SYM_TILE 128
+// Particles per tile of the mixed precision kernel.
+#define DIRECT_MIXED_TILE 256
+// Number of i-particles the blocked kernel keeps in registers at once.
+#define DIRECT_REG_TILE 4
+// j-particles each autotuning candidate is timed against, at most.
+#define DIRECT_TUNE_J 32768
+
+// Instruction sets of the explicitly vectorized kernel.
+#define SIMD_SCALAR 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+
+/*
+* Direct sum that evaluates every pair once and applies the reaction to both
+* particles (Newton's third law). Pairs of tiles are scheduled in rounds in
+* which no tile appears twice, so threads never update the same particle and
+* no atomics are needed.
+*/
+extern void direct_symmetric_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, size_t tile);
+
+/*
+* Cache-blocked direct sum. For each block of ti i-particles the j-particles
+* are visited in blocks of tj, so a j-block is read from cache rather than
+* memory by every group of DIRECT_REG_TILE i-particles of the block.
+* softening is one of the SOFT_* kernels of softening.h; all but SOFT_NONE
+* are finite at r = 0, so the self-interaction contributes exactly zero and
+* the inner loop has no i != j test.
+*/
+extern void direct_blocked_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, size_t ti, size_t tj,
+  int softening = SOFT_LEGACY);
+
+/*
+* Time the blocked kernel for a range of tile sizes on this machine, with
+* the OpenMP team of the current thread setting, and return the fastest
+* pair in ti and tj. Each candidate sums a bounded sample of at most
+* DIRECT_TUNE_J sources, so the cost does not grow with npart.
+*/
+extern void direct_blocked_autotune(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float G, float eps, size_t *ti, size_t *tj, int softening = SOFT_LEGACY);
+
+/*
+* Pick the instruction set for direct_simd_accelerations() by name ("auto",
+* "avx512", "avx2" or "scalar").
+* @return One of the SIMD_* values, or -1 if this CPU does not support it.
+*/
+extern int direct_simd_select(const char *name);
+
+/*
+* Direct sum with explicit AVX2 (8 lanes) or AVX-512 (16 lanes) intrinsics,
+* using hardware reciprocal square root and reciprocal estimates followed by
+* nr Newton-Raphson steps. SIMD_SCALAR runs the blocked kernel instead.
+*
+* Accuracy tiers, as RMS / maximum relative acceleration error against a
+* double precision direct sum (2e4 particles, default box):
+*   nr = 0  AVX2 (12-bit estimates)    1e-4 / 9e-4
+*           AVX-512 (14-bit estimates) 1.5e-5 / 1.6e-4
+*   nr = 1  both                       3e-7 / 2e-6, as the scalar kernel (2e-7 / 1e-6)
+*   nr = 2  both                       3e-7 / 2e-6, no further gain in float
+* On an AVX-512 node nr = 0 and nr = 1 run at 1.5e9 and 1.2e9
+* interactions/s per core, against 1.9e8 for the blocked scalar kernel.
+* make check holds nr = 0 to the AVX2 tier and nr = 1 to 1e-6 / 5e-6.
+*/
+extern void direct_simd_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, int isa, int nr);
+
+/*
+* Mixed precision direct sum: positions and accelerations are double, pair
+* interactions are float. Particles are grouped into spatially compact tiles
+* along a coarse Morton curve, and coordinates are shifted to the origin of
+* the current i-tile in double before rounding to float, so close pairs keep
+* float relative accuracy in their separation however far they are from the
+* global origin. Each tile pair is summed in float and added to double
+* accumulators.
+* Requires eps > 0, as for the blocked kernel.
+*/
+extern void direct_mixed_accelerations(size_t npart,
+  const double *px, const double *py, const double *pz, const float *mass,
+  double *ax, double *ay, double *az, float G, float eps, size_t tile);
+
+/*
+* Direct sum for a subset of the particles: the accelerations of particles
+* active[0..nactive-1] against all npart sources. Other entries of ax, ay
+* and az are left untouched. Requires eps > 0, as for the blocked kernel.
+*/
+extern void direct_active_accelerations(size_t nactive, const size_t *active,
+  size_t npart, const float *px, const float *py, const float *pz,
+  const float *mass, float *ax, float *ay, float *az, float G, float eps);
+
+/*
+* Accelerations and their time derivatives (jerks) in one pair loop, for the
+* Hermite integrator. For separation r, relative velocity v and
+* d = |r| + eps, the jerk due to particle j is
+* G*m_j*(v/d^3 - 3*r*(r.v)/(|r|*d^4)).
+* The inner loop is a branch-free SIMD reduction. Requires eps > 0.
+*/
+extern void direct_jerk_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz,
+  const float *vx, const float *vy, const float *vz, const float *mass,
+  float *ax, float *ay, float *az, float *jx, float *jy, float *jz,
+  float G, float eps);
+
+#endif // DIRECT_H_INCLUDED
@@ -0,0 +1,209 @@
+/**
+* Direct-sum simulation engine templated on the number of dimensions.
+*
+* The state arrays, force kernel, integrator and writer are written once
+* over D coordinates; D is a template argument, so every loop over
+* coordinates is unrolled at compile time and a 2D run carries no
+* z-component at all. particles_nd runs it in 2D or 3D; particles.cpp
+* attaches an engine_state<3> to its own arrays and takes its direct sum,
+* Euler update and VTK output from here.
+*/
+#ifndef ENGINE_H_INCLUDED
+#define ENGINE_H_INCLUDED
+
+#include <fstream>
+#include <math.h>
+#include <stddef.h>
+#include <string>
+
+#include "softening.h"
+#include "utils.h"
+
+template <int D>
+struct engine_state {
+  size_t npart;
+  float *pos[D];    // Particle positions, one array per coordinate.
+  float *vel[D];    // Particle velocities.
+  float *acc[D];    // Particle accelerations.
+  float *mass;      // Particle masses.
+};
+
+/*
+* Allocate the state and place the particles uniformly at random in the box
+* of side scale[d] around center[d], at rest, with masses up to scale_mass.
+*/
+template <int D>
+void
+engine_init(engine_state<D> &s, size_t npart, const float *center,
+  const float *scale, float scale_mass)
+{
+  s.npart = npart;
+  for (int d = 0; d < D; ++d) {
+    s.pos[d] = new float[npart];
+    s.vel[d] = new float[npart];
+    s.acc[d] = new float[npart];
+  }
+  s.mass = new float[npart];
+
+  // Same draw order as init_particles(): the coordinates, then the mass.
+  for (size_t i = 0; i < npart; ++i) {
+    for (int d = 0; d < D; ++d) {
+      s.pos[d][i] = (randu() - 0.5f)*scale[d] + center[d];
+      s.vel[d][i] = 0.0;
+      s.acc[d][i] = 0.0;
+    }
+    s.mass[i] = randu()*scale_mass;
+  }
+}
+
+/*
+* Make s a view of existing arrays, which stay owned by the caller; s must
+* not be passed to engine_free().
+*/
+template <int D>
+void
+engine_attach(engine_state<D> &s, size_t npart, float *const *pos,
+  float *const *vel, float *const *acc, float *mass)
+{
+  s.npart = npart;
+  for (int d = 0; d < D; ++d) {
+    s.pos[d] = pos[d];
+    s.vel[d] = vel[d];
+    s.acc[d] = acc[d];
+  }
+  s.mass = mass;
+}
+
+template <int D>
+void
+engine_free(engine_state<D> &s)
+{
+  for (int d = 0; d < D; ++d) {
+    delete [] s.pos[d];
+    delete [] s.vel[d];
+    delete [] s.acc[d];
+  }
+  delete [] s.mass;
+}
+
+/*
+* Accelerations by summing over all pairs, softened with kernel K (see
+* softening.h); the default is the force law of particles.cpp.
+*/
+template <int D, class K = soft_legacy>
+void
+engine_accelerations(engine_state<D> &s, float G, float eps)
+{
+  size_t npart = s.npart;
+  const float *mass = s.mass;
+
+  // Coordinates past D alias x but are never read: the D > n conditions
+  // below are constants, so for D < 3 the unused terms vanish. The j loop
+  // is a branch-free reduction (apart from inside K) and vectorizes.
+  const float *p0 = s.pos[0];
+  const float *p1 = s.pos[D > 1 ? 1 : 0];
+  const float *p2 = s.pos[D > 2 ? 2 : 0];
+  float *a0 = s.acc[0];
+  float *a1 = s.acc[D > 1 ? 1 : 0];
+  float *a2 = s.acc[D > 2 ? 2 : 0];
+
+  #pragma acc parallel loop present(p0[0:npart], p1[0:npart], p2[0:npart], \
+    a0[0:npart], a1[0:npart], a2[0:npart], mass[0:npart])
+  #pragma omp parallel for schedule(runtime)
+  for (size_t i = 0; i < npart; ++i) {
+    float xi = p0[i];
+    float yi = p1[i];
+    float zi = p2[i];
+
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+
+    #pragma omp simd reduction(+:axi,ayi,azi)
+    for (size_t j = 0; j < npart; ++j) {
+      float dx = p0[j] - xi;
+      float dy = D > 1 ? p1[j] - yi : 0.0f;
+      float dz = D > 2 ? p2[j] - zi : 0.0f;
+      float r2 = dx*dx + dy*dy + dz*dz;
+
+      // Resolved at compile time; only the unsoftened kernel needs it.
+      float f = K::self_check && j == i
+        ? 0.0f : G*mass[j]*K::factor(r2, eps);
+      axi += f*dx;
+      ayi += f*dy;
+      azi += f*dz;
+    }
+
+    a0[i] = axi;
+    if (D > 1) {
+      a1[i] = ayi;
+    }
+    if (D > 2) {
+      a2[i] = azi;
+    }
+  }
+}
+
+/*
+* Advance velocities and positions by dt with the explicit Euler step
+* (velocity first, then position from the new velocity).
+*/
+template <int D>
+void
+engine_integrate(engine_state<D> &s, float dt)
+{
+  size_t npart = s.npart;
+
+  for (int d = 0; d < D; ++d) {
+    float *p = s.pos[d];
+    float *v = s.vel[d];
+    const float *a = s.acc[d];
+
+    #pragma acc parallel loop present(p[0:npart], v[0:npart], a[0:npart])
+    #pragma omp parallel for schedule(runtime)
+    for (size_t i = 0; i < npart; ++i) {
+      v[i] += a[i]*dt;
+      p[i] += v[i]*dt;
+    }
+  }
+}
+
+/*
+* Write the positions as VTK points. VTK points always have three
+* coordinates, so the missing ones are written as 0. If id is given it is
+* written as a point scalar, which tells particles apart after reordering.
+* @return 1 on success, 0 on failure.
+*/
+template <int D>
+int
+engine_write_vtk(const engine_state<D> &s, const std::string &path,
+  const size_t *id = NULL)
+{
+  std::ofstream myfile(path.c_str(), std::ios::out);
+  if (!myfile.is_open()) {
+    return 0;
+  }
+
+  myfile << "# vtk DataFile Version 1.0\n";
+  myfile << D << "D position data\n";
+  myfile << "ASCII\n\n";
+  myfile << "DATASET POLYDATA\n";
+  myfile << "POINTS " << s.npart << " float\n";
+
+  for (size_t i = 0; i < s.npart; ++i) {
+    for (int d = 0; d < 3; ++d) {
+      myfile << (d < D ? s.pos[d][i] : 0.0f) << (d < 2 ? " " : "\n");
+    }
+  }
+
+  if (id) {
+    myfile << "POINT_DATA " << s.npart << "\n";
+    myfile << "SCALARS id unsigned_long 1\n";
+    myfile << "LOOKUP_TABLE default\n";
+    for (size_t i = 0; i < s.npart; ++i) {
+      myfile << id[i] << "\n";
+    }
+  }
+
+  return 1;
+}
+
+#endif // ENGINE_H_INCLUDED
@@ -0,0 +1,463 @@
+/**
+* Fast Multipole Method with Cartesian Taylor expansions of arbitrary order.
+*
+* The octree of barnes_hut.cpp is traversed as a dual tree (Dehnen 2002):
+* every pair of well separated cells interacts once through a multipole to
+* local (M2L) translation, and only pairs of nearby leaves are summed
+* directly. This makes the cost close to O(N) for a fixed order p.
+*
+* Notation: for a multi-index n = (nx, ny, nz), x^n = x^nx y^ny z^nz and
+* n! = nx! ny! nz!. The Taylor coefficients a_n(R) = (1/n!) d^n/dR^n (1/|R|)
+* are obtained with the recurrence of Duan & Krasny (2000):
+*
+*   |n| R^2 a_n = -(2|n|-1) sum_i R_i a_{n-e_i} - (|n|-1) sum_i a_{n-2e_i}.
+*
+* Expansions describe the unsoftened 1/r potential; they are only used for
+* well separated cells, while the near field keeps the eps-softened kernel of
+* the direct sum. Each M2L is scaled to the softened kernel at the distance
+* between the two cell centres, which leaves an O(eps*s/R^2) difference to the
+* direct sum that does not shrink with p (about 5e-4 RMS for the default box
+* at 2e4 particles; see force_check=).
+*
+* The passes run on OpenMP threads. The upward and downward passes work
+* level by level, so a cell only waits on its children or its parent. The
+* traversal starts from every target cell of at most FMM_TASK_SIZE particles
+* (or leaf) against the root; targets are disjoint, so each task writes its
+* own local expansions and accelerations. This skips M2L into the few cells
+* above those targets, which does not change the accuracy.
+*/
+
+#include <math.h>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "barnes_hut.h"
+#include "fmm.h"
+
+using namespace std;
+
+// Pair of coefficients (a, b) combined into coefficient c with factor f.
+struct fmm_term {
+  int a, b, c;
+  double f;
+};
+
+static int tab_order = -1;          // Order the tables below were built for.
+static int ncoef;                   // Number of coefficients with |n| <= p.
+static vector<int> cnx, cny, cnz;   // Multi-index of each coefficient.
+static vector<int> cdeg;            // |n| of each coefficient.
+static vector<double> cfact;        // n! of each coefficient.
+static vector<int> prev1, prev2;    // Index of n-e_i and n-2e_i (or -1).
+static vector<fmm_term> m2l_terms;  // L_k += f M_m a_{k+m}, for |k|+|m| <= p.
+static vector<fmm_term> shift_terms;// Terms n, k <= n with d = n-k, f = n!/k!.
+
+static double
+factorial(int n)
+{
+  double f = 1.0;
+  for (int i = 2; i <= n; ++i) {
+    f *= i;
+  }
+  return f;
+}
+
+/*
+* Build the coefficient tables for order p.
+*/
+static void
+build_tables(int p)
+{
+  if (p == tab_order) {
+    return;
+  }
+  tab_order = p;
+
+  vector<int> idx((p + 1)*(p + 1)*(p + 1), -1);
+  cnx.clear(); cny.clear(); cnz.clear(); cdeg.clear(); cfact.clear();
+
+  // Enumerate multi-indices in order of increasing degree.
+  for (int deg = 0; deg <= p; ++deg) {
+    for (int nx = deg; nx >= 0; --nx) {
+      for (int ny = deg - nx; ny >= 0; --ny) {
+        int nz = deg - nx - ny;
+        idx[(nx*(p + 1) + ny)*(p + 1) + nz] = (int) cnx.size();
+        cnx.push_back(nx);
+        cny.push_back(ny);
+        cnz.push_back(nz);
+        cdeg.push_back(deg);
+        cfact.push_back(factorial(nx)*factorial(ny)*factorial(nz));
+      }
+    }
+  }
+  ncoef = (int) cnx.size();
+
+#define IDX(x, y, z) idx[((x)*(p + 1) + (y))*(p + 1) + (z)]
+
+  prev1.assign(3*ncoef, -1);
+  prev2.assign(3*ncoef, -1);
+  for (int n = 0; n < ncoef; ++n) {
+    int x = cnx[n], y = cny[n], z = cnz[n];
+    if (x >= 1) prev1[3*n] = IDX(x - 1, y, z);
+    if (y >= 1) prev1[3*n + 1] = IDX(x, y - 1, z);
+    if (z >= 1) prev1[3*n + 2] = IDX(x, y, z - 1);
+    if (x >= 2) prev2[3*n] = IDX(x - 2, y, z);
+    if (y >= 2) prev2[3*n + 1] = IDX(x, y - 2, z);
+    if (z >= 2) prev2[3*n + 2] = IDX(x, y, z - 2);
+  }
+
+  m2l_terms.clear();
+  shift_terms.clear();
+  for (int k = 0; k < ncoef; ++k) {
+    for (int m = 0; m < ncoef; ++m) {
+      if (cdeg[k] + cdeg[m] <= p) {
+        fmm_term t;
+        t.a = k;
+        t.b = m;
+        t.c = IDX(cnx[k] + cnx[m], cny[k] + cny[m], cnz[k] + cnz[m]);
+        t.f = ((cdeg[m] & 1) ? -1.0 : 1.0)*cfact[t.c]/cfact[k];
+        m2l_terms.push_back(t);
+      }
+      if (cnx[m] <= cnx[k] && cny[m] <= cny[k] && cnz[m] <= cnz[k]) {
+        fmm_term t;
+        t.a = k;
+        t.b = m;
+        t.c = IDX(cnx[k] - cnx[m], cny[k] - cny[m], cnz[k] - cnz[m]);
+        t.f = cfact[k]/cfact[m];
+        shift_terms.push_back(t);
+      }
+    }
+  }
+
+#undef IDX
+}
+
+/*
+* Fill t[n] = s^n / n! for all |n| <= p.
+*/
+static void
+scaled_powers(double sx, double sy, double sz, double *t)
+{
+  double pwx[FMM_MAX_ORDER + 1], pwy[FMM_MAX_ORDER + 1], pwz[FMM_MAX_ORDER + 1];
+  pwx[0] = pwy[0] = pwz[0] = 1.0;
+  for (int e = 1; e <= tab_order; ++e) {
+    pwx[e] = pwx[e - 1]*sx;
+    pwy[e] = pwy[e - 1]*sy;
+    pwz[e] = pwz[e - 1]*sz;
+  }
+  for (int n = 0; n < ncoef; ++n) {
+    t[n] = pwx[cnx[n]]*pwy[cny[n]]*pwz[cnz[n]]/cfact[n];
+  }
+}
+
+/*
+* Fill a[n] with the Taylor coefficients of 1/|R| for all |n| <= p.
+*/
+static void
+taylor_coefficients(double rx, double ry, double rz, double *a)
+{
+  double r[3] = {rx, ry, rz};
+  double r2 = rx*rx + ry*ry + rz*rz;
+  double inv_r2 = 1.0/r2;
+
+  a[0] = sqrt(inv_r2);
+  for (int n = 1; n < ncoef; ++n) {
+    double s1 = 0.0, s2 = 0.0;
+    for (int i = 0; i < 3; ++i) {
+      if (prev1[3*n + i] >= 0) s1 += r[i]*a[prev1[3*n + i]];
+      if (prev2[3*n + i] >= 0) s2 += a[prev2[3*n + i]];
+    }
+    int deg = cdeg[n];
+    a[n] = (-(2*deg - 1)*s1 - (deg - 1)*s2)*inv_r2/deg;
+  }
+}
+
+// State shared by the traversal.
+struct fmm_context {
+  const bh_tree *tree;
+  const float *px, *py, *pz, *mass;
+  float *ax, *ay, *az;
+  float G, eps, theta2;
+  vector<double> M, L;      // Multipole and local expansions, ncoef per cell.
+};
+
+/*
+* Direct eps-softened sum of the particles of leaf b onto those of leaf a.
+*/
+static void
+p2p(fmm_context &c, const bh_node &a, const bh_node &b)
+{
+  const size_t *index = &c.tree->index[0];
+  for (size_t ka = a.begin; ka < a.end; ++ka) {
+    size_t i = index[ka];
+    float xi = c.px[i], yi = c.py[i], zi = c.pz[i];
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+
+    for (size_t kb = b.begin; kb < b.end; ++kb) {
+      size_t j = index[kb];
+      if (i != j) {
+        float dx = c.px[j] - xi;
+        float dy = c.py[j] - yi;
+        float dz = c.pz[j] - zi;
+
+        float d = sqrt(dx*dx + dy*dy + dz*dz) + c.eps;
+        float s = c.G*c.mass[j]/(d*d*d);
+        axi += s*dx;
+        ayi += s*dy;
+        azi += s*dz;
+      }
+    }
+
+    c.ax[i] += axi;
+    c.ay[i] += ayi;
+    c.az[i] += azi;
+  }
+}
+
+/*
+* Let source cell b act on target cell a, descending until cells are either
+* well separated or both leaves. t is scratch space for ncoef coefficients.
+*/
+static void
+interact(fmm_context &c, int ia, int ib, double *t)
+{
+  const bh_node &a = c.tree->nodes[ia];
+  const bh_node &b = c.tree->nodes[ib];
+
+  double rx = (double) a.cx - b.cx;
+  double ry = (double) a.cy - b.cy;
+  double rz = (double) a.cz - b.cz;
+  double r2 = rx*rx + ry*ry + rz*rz;
+  double rad = sqrt(3.0)*((double) a.half + b.half);
+
+  if (rad*rad < c.theta2*r2) {
+    // M2L: translate the multipoles of b into the local expansion of a.
+    taylor_coefficients(rx, ry, rz, t);
+    const double *Mb = &c.M[(size_t) ib*ncoef];
+    double *La = &c.L[(size_t) ia*ncoef];
+
+    // Scale by (R/(R+eps))^3 so the monopole term matches the softened
+    // kernel at the distance between the cell centres.
+    double r = sqrt(r2);
+    double soft = r/(r + c.eps);
+    soft = soft*soft*soft;
+    for (size_t k = 0; k < m2l_terms.size(); ++k) {
+      const fmm_term &term = m2l_terms[k];
+      La[term.a] += soft*term.f*Mb[term.b]*t[term.c];
+    }
+    return;
+  }
+
+  if (a.leaf && b.leaf) {
+    p2p(c, a, b);
+  } else if (b.leaf || (!a.leaf && a.half >= b.half)) {
+    for (int k = 0; k < 8; ++k) {
+      if (a.child[k] >= 0) {
+        interact(c, a.child[k], ib, t);
+      }
+    }
+  } else {
+    for (int k = 0; k < 8; ++k) {
+      if (b.child[k] >= 0) {
+        interact(c, ia, b.child[k], t);
+      }
+    }
+  }
+}
+
+/*
+* Collect into targets the cells of at most FMM_TASK_SIZE particles, or
+* leaves, that together cover the subtree of cell n.
+*/
+static void
+collect_targets(const bh_tree &tree, int n, vector<int> &targets)
+{
+  const bh_node &node = tree.nodes[n];
+  if (node.leaf || node.end - node.begin <= FMM_TASK_SIZE) {
+    targets.push_back(n);
+    return;
+  }
+  for (int k = 0; k < 8; ++k) {
+    if (node.child[k] >= 0) {
+      collect_targets(tree, node.child[k], targets);
+    }
+  }
+}
+
+/*
+* Upward pass over one cell, whose children are done.
+*/
+static void
+upward(fmm_context &c, size_t n, double *t)
+{
+  const bh_tree &tree = *c.tree;
+  const bh_node &node = tree.nodes[n];
+  const size_t *index = &tree.index[0];
+  double *Mn = &c.M[n*ncoef];
+
+  if (node.leaf) {
+    // P2M: M_n = sum_j m_j (x_j - c)^n / n!.
+    for (size_t k = node.begin; k < node.end; ++k) {
+      size_t j = index[k];
+      scaled_powers((double) c.px[j] - node.cx, (double) c.py[j] - node.cy,
+        (double) c.pz[j] - node.cz, t);
+      for (int m = 0; m < ncoef; ++m) {
+        Mn[m] += c.mass[j]*t[m];
+      }
+    }
+    return;
+  }
+
+  // M2M: M'_n = sum_{k <= n} M_k (c - c')^(n-k) / (n-k)!.
+  for (int k = 0; k < 8; ++k) {
+    if (node.child[k] < 0) {
+      continue;
+    }
+    const bh_node &ch = tree.nodes[node.child[k]];
+    const double *Mc = &c.M[(size_t) node.child[k]*ncoef];
+    scaled_powers((double) ch.cx - node.cx, (double) ch.cy - node.cy,
+      (double) ch.cz - node.cz, t);
+    for (size_t s = 0; s < shift_terms.size(); ++s) {
+      const fmm_term &term = shift_terms[s];
+      Mn[term.a] += Mc[term.b]*t[term.c];
+    }
+  }
+}
+
+/*
+* Downward pass over one cell, whose parent is done: L2L to the children,
+* or L2P at a leaf.
+*/
+static void
+downward(fmm_context &c, size_t n, double *t)
+{
+  const bh_tree &tree = *c.tree;
+  const bh_node &node = tree.nodes[n];
+  const size_t *index = &tree.index[0];
+  const double *Ln = &c.L[n*ncoef];
+  int p = tab_order;
+
+  if (!node.leaf) {
+    // L'_k = sum_{n >= k} L_n (n!/k!) (z' - z)^(n-k) / (n-k)!.
+    for (int k = 0; k < 8; ++k) {
+      if (node.child[k] < 0) {
+        continue;
+      }
+      const bh_node &ch = tree.nodes[node.child[k]];
+      double *Lc = &c.L[(size_t) node.child[k]*ncoef];
+      scaled_powers((double) ch.cx - node.cx, (double) ch.cy - node.cy,
+        (double) ch.cz - node.cz, t);
+      for (size_t s = 0; s < shift_terms.size(); ++s) {
+        const fmm_term &term = shift_terms[s];
+        Lc[term.b] += Ln[term.a]*term.f*t[term.c];
+      }
+    }
+    return;
+  }
+
+  // L2P: a = G grad(sum_n L_n (x - z)^n).
+  for (size_t k = node.begin; k < node.end; ++k) {
+    size_t i = index[k];
+    double pw[3][FMM_MAX_ORDER + 1];
+    double d[3] = {(double) c.px[i] - node.cx, (double) c.py[i] - node.cy,
+      (double) c.pz[i] - node.cz};
+    for (int e = 0; e < 3; ++e) {
+      pw[e][0] = 1.0;
+      for (int q = 1; q <= p; ++q) {
+        pw[e][q] = pw[e][q - 1]*d[e];
+      }
+    }
+
+    double gx = 0.0, gy = 0.0, gz = 0.0;
+    for (int m = 1; m < ncoef; ++m) {
+      int x = cnx[m], y = cny[m], z = cnz[m];
+      if (x > 0) gx += Ln[m]*x*pw[0][x - 1]*pw[1][y]*pw[2][z];
+      if (y > 0) gy += Ln[m]*y*pw[0][x]*pw[1][y - 1]*pw[2][z];
+      if (z > 0) gz += Ln[m]*z*pw[0][x]*pw[1][y]*pw[2][z - 1];
+    }
+
+    c.ax[i] += (float) (c.G*gx);
+    c.ay[i] += (float) (c.G*gy);
+    c.az[i] += (float) (c.G*gz);
+  }
+}
+
+void
+fmm_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float theta, int p)
+{
+  if (npart == 0) {
+    return;
+  }
+  build_tables(p);
+
+  bh_tree tree;
+  bh_build(tree, npart, px, py, pz, mass, FMM_LEAF_SIZE);
+  size_t nnodes = tree.nodes.size();
+
+  fmm_context c;
+  c.tree = &tree;
+  c.px = px; c.py = py; c.pz = pz; c.mass = mass;
+  c.ax = ax; c.ay = ay; c.az = az;
+  c.G = G;
+  c.eps = eps;
+  c.theta2 = theta*theta;
+  c.M.assign(nnodes*ncoef, 0.0);
+  c.L.assign(nnodes*ncoef, 0.0);
+
+  // Cells grouped by depth. Children are stored after their parent.
+  vector<int> depth(nnodes, 0);
+  vector<vector<int> > levels;
+  for (size_t n = 0; n < nnodes; ++n) {
+    if ((size_t) depth[n] >= levels.size()) {
+      levels.resize(depth[n] + 1);
+    }
+    levels[depth[n]].push_back((int) n);
+    for (int k = 0; k < 8; ++k) {
+      if (tree.nodes[n].child[k] >= 0) {
+        depth[tree.nodes[n].child[k]] = depth[n] + 1;
+      }
+    }
+  }
+  vector<int> targets;
+  collect_targets(tree, 0, targets);
+  int nlevels = (int) levels.size();
+  int ntargets = (int) targets.size();
+
+  #pragma omp parallel
+  {
+    vector<double> t(ncoef);
+
+    #pragma omp for schedule(static)
+    for (size_t i = 0; i < npart; ++i) {
+      ax[i] = 0.0;
+      ay[i] = 0.0;
+      az[i] = 0.0;
+    }
+
+    for (int d = nlevels - 1; d >= 0; --d) {
+      const vector<int> &level = levels[d];
+      #pragma omp for schedule(dynamic, 16)
+      for (size_t k = 0; k < level.size(); ++k) {
+        upward(c, level[k], &t[0]);
+      }
+    }
+
+    // Far field into the local expansions, near field directly.
+    #pragma omp for schedule(dynamic, 1)
+    for (int k = 0; k < ntargets; ++k) {
+      interact(c, targets[k], 0, &t[0]);
+    }
+
+    for (int d = 0; d < nlevels; ++d) {
+      const vector<int> &level = levels[d];
+      #pragma omp for schedule(dynamic, 16)
+      for (size_t k = 0; k < level.size(); ++k) {
+        downward(c, level[k], &t[0]);
+      }
+    }
+  }
+}
@@ -0,0 +1,33 @@
+/* Fast Multipole Method built on the Barnes-Hut octree. */
+#ifndef FMM_H_INCLUDED
+#define FMM_H_INCLUDED
+
+#include <stddef.h>
+
+// Maximum number of particles kept in a leaf of the FMM tree.
+#define FMM_LEAF_SIZE 32
+// Largest target cell of one traversal task.
+#define FMM_TASK_SIZE 2048
+// Lowest and highest supported expansion orders. Order 0 has no gradient
+// term in the local expansion, so the far field would exert no force.
+#define FMM_MIN_ORDER 1
+#define FMM_MAX_ORDER 12
+
+/*
+* Compute accelerations with Cartesian expansions of order p. Cells whose
+* circumscribed spheres satisfy (r_a + r_b) < theta*R interact through their
+* expansions; all other pairs of leaves are summed directly with the usual
+* eps-softened kernel.
+*
+* At theta = 0.5 the RMS / maximum relative acceleration error against a
+* double precision direct sum (2000 particles, default box) is
+*   p = 2  5e-3 / 2.7e-2
+*   p = 4  2e-4 / 1.2e-3
+*   p = 6  1.4e-4 / 7e-4
+* make check holds the default p = 4 to 5e-4 / 3e-3.
+*/
+extern void fmm_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float theta, int p);
+
+#endif // FMM_H_INCLUDED
@@ -0,0 +1,80 @@
+/**
+* Fourth-order Hermite integrator with a shared time-step.
+*/
+
+#include "direct.h"
+#include "hermite.h"
+
+void
+hermite_init(hermite_state &state, size_t npart)
+{
+  state.started = false;
+  std::vector<float> *arrays[] = {
+    &state.jx, &state.jy, &state.jz, &state.x0, &state.y0, &state.z0,
+    &state.vx0, &state.vy0, &state.vz0, &state.ax0, &state.ay0, &state.az0,
+    &state.jx0, &state.jy0, &state.jz0
+  };
+  for (size_t k = 0; k < sizeof(arrays)/sizeof(arrays[0]); ++k) {
+    arrays[k]->assign(npart, 0.0f);
+  }
+}
+
+int
+hermite_step(hermite_state &state, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  float *ax, float *ay, float *az, const float *mass, float G, float eps,
+  float dt)
+{
+  float *jx = &state.jx[0], *jy = &state.jy[0], *jz = &state.jz[0];
+  int evals = 0;
+
+  if (!state.started) {
+    direct_jerk_accelerations(npart, px, py, pz, vx, vy, vz, mass,
+      ax, ay, az, jx, jy, jz, G, eps);
+    state.started = true;
+    ++evals;
+  }
+
+  float *x0 = &state.x0[0], *y0 = &state.y0[0], *z0 = &state.z0[0];
+  float *vx0 = &state.vx0[0], *vy0 = &state.vy0[0], *vz0 = &state.vz0[0];
+  float *ax0 = &state.ax0[0], *ay0 = &state.ay0[0], *az0 = &state.az0[0];
+  float *jx0 = &state.jx0[0], *jy0 = &state.jy0[0], *jz0 = &state.jz0[0];
+  float dt2 = dt*dt/2;
+  float dt3 = dt*dt*dt/6;
+
+  // Predictor.
+  #pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < npart; ++i) {
+    x0[i] = px[i]; y0[i] = py[i]; z0[i] = pz[i];
+    vx0[i] = vx[i]; vy0[i] = vy[i]; vz0[i] = vz[i];
+    ax0[i] = ax[i]; ay0[i] = ay[i]; az0[i] = az[i];
+    jx0[i] = jx[i]; jy0[i] = jy[i]; jz0[i] = jz[i];
+
+    px[i] += vx[i]*dt + ax[i]*dt2 + jx[i]*dt3;
+    py[i] += vy[i]*dt + ay[i]*dt2 + jy[i]*dt3;
+    pz[i] += vz[i]*dt + az[i]*dt2 + jz[i]*dt3;
+    vx[i] += ax[i]*dt + jx[i]*dt2;
+    vy[i] += ay[i]*dt + jy[i]*dt2;
+    vz[i] += az[i]*dt + jz[i]*dt2;
+  }
+
+  direct_jerk_accelerations(npart, px, py, pz, vx, vy, vz, mass,
+    ax, ay, az, jx, jy, jz, G, eps);
+  ++evals;
+
+  // Corrector.
+  float h = dt/2;
+  float h2 = dt*dt/12;
+  #pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < npart; ++i) {
+    vx[i] = vx0[i] + (ax0[i] + ax[i])*h + (jx0[i] - jx[i])*h2;
+    vy[i] = vy0[i] + (ay0[i] + ay[i])*h + (jy0[i] - jy[i])*h2;
+    vz[i] = vz0[i] + (az0[i] + az[i])*h + (jz0[i] - jz[i])*h2;
+
+    px[i] = x0[i] + (vx0[i] + vx[i])*h + (ax0[i] - ax[i])*h2;
+    py[i] = y0[i] + (vy0[i] + vy[i])*h + (ay0[i] - ay[i])*h2;
+    pz[i] = z0[i] + (vz0[i] + vz[i])*h + (az0[i] - az[i])*h2;
+  }
+
+  return evals;
+}
@@ -0,0 +1,47 @@
+/* Fourth-order Hermite predictor-corrector integrator. */
+#ifndef HERMITE_H_INCLUDED
+#define HERMITE_H_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+
+/*
+* State carried between steps: the jerks matching the accelerations, and
+* the positions, velocities, accelerations and jerks at the start of the
+* current step.
+*/
+struct hermite_state {
+  bool started;                 // Accelerations and jerks are current.
+  std::vector<float> jx;        // Jerk of each particle.
+  std::vector<float> jy;
+  std::vector<float> jz;
+  std::vector<float> x0;        // Start-of-step copies for the corrector.
+  std::vector<float> y0;
+  std::vector<float> z0;
+  std::vector<float> vx0;
+  std::vector<float> vy0;
+  std::vector<float> vz0;
+  std::vector<float> ax0;
+  std::vector<float> ay0;
+  std::vector<float> az0;
+  std::vector<float> jx0;
+  std::vector<float> jy0;
+  std::vector<float> jz0;
+};
+
+extern void hermite_init(hermite_state &state, size_t npart);
+
+/*
+* Advance all particles by dt (Makino & Aarseth 1992): predict positions and
+* velocities to third order in dt from the current accelerations and jerks,
+* evaluate new accelerations and jerks at the predicted state with the
+* fused direct-sum kernel, and correct with the Hermite interpolation.
+* ax, ay and az hold the accelerations at the end of the step.
+* @return The number of force evaluations (1, or 2 on the first step).
+*/
+extern int hermite_step(hermite_state &state, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  float *ax, float *ay, float *az, const float *mass, float G, float eps,
+  float dt);
+
+#endif // HERMITE_H_INCLUDED
@@ -0,0 +1,512 @@
+/**
+* Distributed Barnes-Hut: orthogonal recursive bisection of the box into one
+* domain per rank, particle migration, and locally essential trees (LET,
+* Salmon & Warren 1994).
+*/
+
+#include <algorithm>
+#include <float.h>
+#include <iostream>
+#include <limits.h>
+#include <math.h>
+
+#include "mpi_orb.h"
+
+/*
+* A particle in flight to another rank.
+*/
+struct orb_particle {
+  float q[8];                   // x, y, z, vx, vy, vz, mass and cost.
+  size_t id;
+};
+
+/*
+* A particle of orb_gather(): the id followed by the six coordinates.
+*/
+struct orb_record {
+  size_t id;
+  float q[6];
+};
+
+void
+orb_share(size_t npart, int nranks, int rank, size_t *first, size_t *count)
+{
+  *first = rank*npart/nranks;
+  *count = (rank + 1)*npart/nranks - *first;
+}
+
+void
+orb_init(orb_state &orb, MPI_Comm comm, const float lo[3], const float hi[3],
+  size_t first, size_t count, const float *px, const float *py,
+  const float *pz, const float *vx, const float *vy, const float *vz,
+  const float *mass)
+{
+  orb.comm = comm;
+  MPI_Comm_rank(comm, &orb.rank);
+  MPI_Comm_size(comm, &orb.nranks);
+  for (int d = 0; d < 3; ++d) {
+    orb.box_lo[d] = lo[d];
+    orb.box_hi[d] = hi[d];
+  }
+
+  // Messages count whole particles, so a rank may send 2^31 of them rather
+  // than 2^31 bytes.
+  MPI_Type_contiguous(sizeof(orb_particle), MPI_BYTE, &orb.particle_type);
+  MPI_Type_commit(&orb.particle_type);
+  MPI_Type_contiguous(sizeof(orb_record), MPI_BYTE, &orb.record_type);
+  MPI_Type_commit(&orb.record_type);
+  MPI_Type_contiguous(4, MPI_FLOAT, &orb.let_type);
+  MPI_Type_commit(&orb.let_type);
+
+  const float *in[7] = {px, py, pz, vx, vy, vz, mass};
+  for (int k = 0; k < 7; ++k) {
+    orb.q[k].assign(in[k], in[k] + count);
+  }
+  orb.cost.assign(count, 1.0f);
+  orb.id.resize(count);
+  for (size_t i = 0; i < count; ++i) {
+    orb.id[i] = first + i;
+  }
+
+  orb.imbalance = 1;
+  orb.imbalance_sum = 0;
+  orb.imbalance_max = 0;
+  orb.steps = 0;
+  orb.let_items = 0;
+  orb.migrated = 0;
+  orb.force_time = 0;
+  orb.comm_time = 0;
+}
+
+void
+orb_free(orb_state &orb)
+{
+  MPI_Type_free(&orb.particle_type);
+  MPI_Type_free(&orb.record_type);
+  MPI_Type_free(&orb.let_type);
+}
+
+/*
+* n items as an MPI count. MPI-3 counts are int, so a larger message aborts
+* the run rather than wrapping around.
+*/
+static int
+orb_count(const orb_state &orb, size_t n)
+{
+  if (n > (size_t) INT_MAX) {
+    std::cerr << "orb: " << n << " items exceed the MPI count range\n";
+    MPI_Abort(orb.comm, 1);
+  }
+  return (int) n;
+}
+
+/*
+* Rank whose domain contains the point p.
+*/
+static int
+orb_locate(const orb_state &orb, const float *p)
+{
+  int n = 0;
+  while (orb.nodes[n].nranks > 1) {
+    const orb_node &node = orb.nodes[n];
+    n = node.child[p[node.dim] >= node.split];
+  }
+  return orb.nodes[n].first;
+}
+
+/*
+* Rebuild the bisection tree from the current particles and costs. Each
+* node's plane puts the node's share of the cost for its lower ranks below
+* it. The first partition cuts each node along the longest side of its part
+* of the box; later ones keep those directions, as a node whose sides are
+* nearly equal would otherwise flip between them and move most of its
+* particles every step.
+*/
+static void
+orb_partition(orb_state &orb)
+{
+  size_t n = orb.id.size();
+  std::vector<orb_node> old;
+  old.swap(orb.nodes);
+  orb.leaf.assign(orb.nranks, 0);
+
+  // clip[6*k..] is the part of the box inside node k's domain.
+  orb_node root;
+  std::vector<float> clip;
+  root.first = 0;
+  root.nranks = orb.nranks;
+  root.dim = 0;
+  root.split = 0;
+  root.child[0] = root.child[1] = -1;
+  for (int d = 0; d < 3; ++d) {
+    root.lo[d] = -FLT_MAX;
+    root.hi[d] = FLT_MAX;
+    clip.push_back(orb.box_lo[d]);
+  }
+  for (int d = 0; d < 3; ++d) {
+    clip.push_back(orb.box_hi[d]);
+  }
+  orb.nodes.push_back(root);
+
+  std::vector<int> label(n, 0);
+  std::vector<int> level(1, 0);
+  long resolution = 1;
+  for (int pass = 0; pass < ORB_PASSES; ++pass) {
+    resolution *= ORB_BINS;
+  }
+
+  while (!level.empty()) {
+    // Nodes of this level shared by more than one rank are cut.
+    std::vector<int> cut, slot(orb.nodes.size(), -1);
+    for (size_t k = 0; k < level.size(); ++k) {
+      if (orb.nodes[level[k]].nranks > 1) {
+        slot[level[k]] = cut.size();
+        cut.push_back(level[k]);
+      } else {
+        orb.leaf[orb.nodes[level[k]].first] = level[k];
+      }
+    }
+    if (cut.empty()) {
+      break;
+    }
+
+    size_t nc = cut.size();
+    for (size_t c = 0; c < nc; ++c) {
+      const float *lo = &clip[6*cut[c]], *hi = lo + 3;
+      int dim = 0;
+      for (int d = 1; d < 3; ++d) {
+        dim = hi[d] - lo[d] > hi[dim] - lo[dim] ? d : dim;
+      }
+      orb.nodes[cut[c]].dim = old.empty() ? dim : old[cut[c]].dim;
+    }
+
+    // Fine bin of each particle at the final resolution.
+    std::vector<long> fine(n, -1);
+    for (size_t i = 0; i < n; ++i) {
+      int s = slot[label[i]];
+      if (s < 0) {
+        continue;
+      }
+      int dim = orb.nodes[cut[s]].dim;
+      const float *lo = &clip[6*cut[s]], *hi = lo + 3;
+      double t = hi[dim] > lo[dim]
+        ? (orb.q[dim][i] - lo[dim])/(hi[dim] - lo[dim]) : 0.5;
+      t = t < 0 ? 0 : t > 1 ? 1 : t;
+      long k = (long) (t*resolution);
+      fine[i] = k < resolution ? k : resolution - 1;
+    }
+
+    // Narrow each plane down one histogram level per pass.
+    std::vector<long> prefix(nc, 0);
+    std::vector<double> below(nc, 0), target(nc, 0), frac(nc, 0.5);
+    std::vector<double> hist(nc*ORB_BINS), total(nc*ORB_BINS);
+    long width = resolution;
+    for (int pass = 0; pass < ORB_PASSES; ++pass) {
+      width /= ORB_BINS;
+      hist.assign(nc*ORB_BINS, 0.0);
+      for (size_t i = 0; i < n; ++i) {
+        if (fine[i] < 0) {
+          continue;
+        }
+        int s = slot[label[i]];
+        long k = fine[i]/width;
+        if (k/ORB_BINS == prefix[s]) {
+          hist[s*ORB_BINS + k%ORB_BINS] += orb.cost[i];
+        }
+      }
+      MPI_Allreduce(&hist[0], &total[0], nc*ORB_BINS, MPI_DOUBLE, MPI_SUM,
+        orb.comm);
+
+      for (size_t c = 0; c < nc; ++c) {
+        const double *h = &total[c*ORB_BINS];
+        if (pass == 0) {
+          double w = 0;
+          for (int b = 0; b < ORB_BINS; ++b) {
+            w += h[b];
+          }
+          const orb_node &node = orb.nodes[cut[c]];
+          target[c] = w*(node.nranks/2)/node.nranks;
+        }
+
+        int b = 0;
+        while (b < ORB_BINS - 1 && below[c] + h[b] < target[c]) {
+          below[c] += h[b++];
+        }
+        prefix[c] = prefix[c]*ORB_BINS + b;
+        frac[c] = h[b] > 0 ? (target[c] - below[c])/h[b] : 0.5;
+      }
+    }
+
+    // Cut, and move the particles of each cut node to its children.
+    std::vector<int> next;
+    for (size_t c = 0; c < nc; ++c) {
+      int id = cut[c];
+      int dim = orb.nodes[id].dim;
+      float lo = clip[6*id + dim], hi = clip[6*id + 3 + dim];
+      float split = lo + (hi - lo)*(prefix[c] + frac[c])/resolution;
+      orb.nodes[id].split = split;
+
+      for (int side = 0; side < 2; ++side) {
+        orb_node child = orb.nodes[id];
+        int nlow = child.nranks/2;
+        child.first += side ? nlow : 0;
+        child.nranks = side ? child.nranks - nlow : nlow;
+        child.child[0] = child.child[1] = -1;
+        (side ? child.lo : child.hi)[dim] = split;
+
+        int k = orb.nodes.size();
+        orb.nodes[id].child[side] = k;
+        orb.nodes.push_back(child);
+        float box[6];
+        std::copy(clip.begin() + 6*id, clip.begin() + 6*id + 6, box);
+        box[(side ? 0 : 3) + dim] = split;
+        clip.insert(clip.end(), box, box + 6);
+        next.push_back(k);
+      }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      if (fine[i] >= 0) {
+        const orb_node &node = orb.nodes[label[i]];
+        label[i] = node.child[orb.q[node.dim][i] >= node.split];
+      }
+    }
+    level.swap(next);
+  }
+}
+
+/*
+* Send every particle to the rank whose domain contains it.
+*/
+static void
+orb_migrate(orb_state &orb)
+{
+  size_t n = orb.id.size();
+  int P = orb.nranks;
+  std::vector<int> dest(n), scount(P, 0), rcount(P), sdispl(P), rdispl(P);
+  for (size_t i = 0; i < n; ++i) {
+    float p[3] = {orb.q[0][i], orb.q[1][i], orb.q[2][i]};
+    dest[i] = orb_locate(orb, p);
+    ++scount[dest[i]];
+  }
+  orb.migrated += n - scount[orb.rank];
+
+  MPI_Alltoall(&scount[0], 1, MPI_INT, &rcount[0], 1, MPI_INT, orb.comm);
+  size_t nrecv = 0;
+  for (int r = 0; r < P; ++r) {
+    sdispl[r] = r ? sdispl[r - 1] + scount[r - 1] : 0;
+    rdispl[r] = nrecv;
+    nrecv += rcount[r];
+  }
+
+  std::vector<orb_particle> out(n), in(nrecv);
+  std::vector<int> pos(sdispl);
+  for (size_t i = 0; i < n; ++i) {
+    orb_particle &p = out[pos[dest[i]]++];
+    for (int k = 0; k < 7; ++k) {
+      p.q[k] = orb.q[k][i];
+    }
+    p.q[7] = orb.cost[i];
+    p.id = orb.id[i];
+  }
+
+  MPI_Alltoallv(n ? &out[0] : NULL, &scount[0], &sdispl[0],
+    orb.particle_type, nrecv ? &in[0] : NULL, &rcount[0], &rdispl[0],
+    orb.particle_type, orb.comm);
+
+  for (int k = 0; k < 7; ++k) {
+    orb.q[k].resize(nrecv);
+  }
+  orb.cost.resize(nrecv);
+  orb.id.resize(nrecv);
+  for (size_t i = 0; i < nrecv; ++i) {
+    for (int k = 0; k < 7; ++k) {
+      orb.q[k][i] = in[i].q[k];
+    }
+    orb.cost[i] = in[i].q[7];
+    orb.id[i] = in[i].id;
+  }
+}
+
+/*
+* Exchange locally essential trees and append the received cells and
+* particles to orb.src after the owned particles.
+*/
+static void
+orb_exchange_let(orb_state &orb, float theta)
+{
+  size_t n = orb.id.size();
+  int P = orb.nranks;
+  bh_build(orb.tree, n, &orb.q[0][0], &orb.q[1][0], &orb.q[2][0],
+    &orb.q[6][0]);
+
+  // x, y, z and mass of each item, grouped by destination rank. Counts
+  // and displacements are in items of let_type, not floats.
+  std::vector<float> out;
+  std::vector<unsigned long> sitems(P, 0);
+  std::vector<size_t> sfirst(P, 0);
+  float inv_theta = 1.0f/theta;
+  for (int r = 0; r < P && n > 0; ++r) {
+    sfirst[r] = out.size()/4;
+    if (r == orb.rank) {
+      continue;
+    }
+    const orb_node &dom = orb.nodes[orb.leaf[r]];
+
+    int stack[8*(BH_MAX_DEPTH + 1)];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const bh_node &node = orb.tree.nodes[stack[--top]];
+
+      if (!node.leaf) {
+        // Nearest distance from the centre of mass to the domain.
+        float c[3] = {node.mx, node.my, node.mz};
+        float r2 = 0;
+        for (int d = 0; d < 3; ++d) {
+          float gap = fmaxf(0.0f, fmaxf(dom.lo[d] - c[d], c[d] - dom.hi[d]));
+          r2 += gap*gap;
+        }
+        float ox = node.mx - node.cx;
+        float oy = node.my - node.cy;
+        float oz = node.mz - node.cz;
+        float open = 2.0f*node.half*inv_theta + sqrt(ox*ox + oy*oy + oz*oz);
+
+        if (r2 > open*open) {
+          float item[4] = {node.mx, node.my, node.mz, node.mass};
+          out.insert(out.end(), item, item + 4);
+        } else {
+          for (int k = 0; k < 8; ++k) {
+            if (node.child[k] >= 0) {
+              stack[top++] = node.child[k];
+            }
+          }
+        }
+        continue;
+      }
+
+      for (size_t k = node.begin; k < node.end; ++k) {
+        size_t j = orb.tree.index[k];
+        float item[4] = {orb.q[0][j], orb.q[1][j], orb.q[2][j], orb.q[6][j]};
+        out.insert(out.end(), item, item + 4);
+      }
+    }
+    sitems[r] = out.size()/4 - sfirst[r];
+  }
+
+  std::vector<unsigned long> ritems(P);
+  MPI_Alltoall(&sitems[0], 1, MPI_UNSIGNED_LONG, &ritems[0], 1,
+    MPI_UNSIGNED_LONG, orb.comm);
+  std::vector<int> scount(P), sdispl(P), rcount(P), rdispl(P);
+  size_t nlet = 0;
+  for (int r = 0; r < P; ++r) {
+    scount[r] = orb_count(orb, sitems[r]);
+    sdispl[r] = orb_count(orb, sfirst[r]);
+    rcount[r] = orb_count(orb, ritems[r]);
+    rdispl[r] = orb_count(orb, nlet);
+    nlet += ritems[r];
+  }
+  std::vector<float> in(4*nlet);
+  MPI_Alltoallv(out.empty() ? NULL : &out[0], &scount[0], &sdispl[0],
+    orb.let_type, nlet ? &in[0] : NULL, &rcount[0], &rdispl[0], orb.let_type,
+    orb.comm);
+
+  orb.let_items += nlet;
+  for (int k = 0; k < 4; ++k) {
+    const std::vector<float> &own = orb.q[k < 3 ? k : 6];
+    orb.src[k].assign(own.begin(), own.end());
+    orb.src[k].resize(n + nlet);
+    for (size_t i = 0; i < nlet; ++i) {
+      orb.src[k][n + i] = in[4*i + k];
+    }
+  }
+}
+
+void
+orb_step(orb_state &orb, float G, float eps, float theta, float dt)
+{
+  double t0 = MPI_Wtime();
+  orb_partition(orb);
+  orb_migrate(orb);
+  orb_exchange_let(orb, theta);
+  double t1 = MPI_Wtime();
+
+  size_t n = orb.id.size();
+  size_t ns = orb.src[0].size();
+  for (int k = 0; k < 3; ++k) {
+    orb.acc[k].resize(n);
+  }
+  orb.work.resize(n);
+  if (n > 0) {
+    bh_build(orb.tree, ns, &orb.src[0][0], &orb.src[1][0], &orb.src[2][0],
+      &orb.src[3][0]);
+    bh_accelerations(orb.tree, n, &orb.src[0][0], &orb.src[1][0],
+      &orb.src[2][0], &orb.src[3][0], &orb.acc[0][0], &orb.acc[1][0],
+      &orb.acc[2][0], G, eps, theta, &orb.work[0]);
+  }
+  double t2 = MPI_Wtime();
+
+  double work = 0;
+  for (size_t i = 0; i < n; ++i) {
+    orb.cost[i] = orb.work[i];
+    work += orb.work[i];
+
+    for (int d = 0; d < 3; ++d) {
+      orb.q[3 + d][i] += orb.acc[d][i]*dt;
+      orb.q[d][i] += orb.q[3 + d][i]*dt;
+    }
+  }
+
+  double total, most;
+  MPI_Allreduce(&work, &total, 1, MPI_DOUBLE, MPI_SUM, orb.comm);
+  MPI_Allreduce(&work, &most, 1, MPI_DOUBLE, MPI_MAX, orb.comm);
+  orb.imbalance = total > 0 ? most*orb.nranks/total : 1;
+  orb.imbalance_sum += orb.imbalance;
+  orb.imbalance_max = std::max(orb.imbalance_max, orb.imbalance);
+  ++orb.steps;
+
+  orb.force_time += t2 - t1;
+  orb.comm_time += t1 - t0;
+}
+
+void
+orb_gather(orb_state &orb, int root, float *px, float *py, float *pz,
+  float *vx, float *vy, float *vz)
+{
+  size_t n = orb.id.size();
+  std::vector<orb_record> buf(n);
+  for (size_t i = 0; i < n; ++i) {
+    buf[i].id = orb.id[i];
+    for (int k = 0; k < 6; ++k) {
+      buf[i].q[k] = orb.q[k][i];
+    }
+  }
+
+  if (orb.rank != root) {
+    MPI_Send(n ? &buf[0] : NULL, (int) n, orb.record_type, root, 0,
+      orb.comm);
+    return;
+  }
+
+  // Root's own particles first, then those of each other rank in turn.
+  float *dst[6] = {px, py, pz, vx, vy, vz};
+  for (int r = -1; r < orb.nranks; ++r) {
+    if (r == root) {
+      continue;
+    }
+    if (r >= 0) {
+      MPI_Status status;
+      int count;
+      MPI_Probe(r, 0, orb.comm, &status);
+      MPI_Get_count(&status, orb.record_type, &count);
+      buf.resize(count);
+      MPI_Recv(count ? &buf[0] : NULL, count, orb.record_type, r, 0,
+        orb.comm, MPI_STATUS_IGNORE);
+    }
+    for (size_t i = 0; i < buf.size(); ++i) {
+      for (int k = 0; k < 6; ++k) {
+        dst[k][buf[i].id] = buf[i].q[k];
+      }
+    }
+  }
+}
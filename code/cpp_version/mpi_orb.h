@@ -0,0 +1,110 @@
+/* Barnes-Hut gravity distributed by orthogonal recursive bisection. */
+#ifndef MPI_ORB_H_INCLUDED
+#define MPI_ORB_H_INCLUDED
+
+#include <mpi.h>
+#include <stddef.h>
+#include <vector>
+
+#include "barnes_hut.h"
+
+// Histogram bins per pass when searching for a bisection plane.
+#define ORB_BINS 256
+// Histogram passes per plane; each narrows the plane to a single bin.
+#define ORB_PASSES 2
+
+/*
+* A node of the bisection tree, shared by all ranks. Ranks [first,
+* first + nranks) share the domain lo..hi. Interior nodes are cut at split
+* along dim; a leaf (nranks == 1) is the domain of rank first. Outer domain
+* faces are infinite so the domains cover all of space.
+*/
+struct orb_node {
+  int first;
+  int nranks;
+  int dim;
+  float split;
+  int child[2];
+  float lo[3];
+  float hi[3];
+};
+
+/*
+* The particles owned by one rank and the decomposition. Particles move
+* between ranks, so each carries its index in the global arrays.
+*/
+struct orb_state {
+  MPI_Comm comm;
+  int rank;
+  int nranks;
+  float box_lo[3];              // Box that is bisected.
+  float box_hi[3];
+  std::vector<orb_node> nodes;  // nodes[0] is the whole of space.
+  std::vector<int> leaf;        // Node of each rank's domain.
+
+  MPI_Datatype particle_type;   // One particle in flight, as a record.
+  MPI_Datatype record_type;     // One particle of orb_gather().
+  MPI_Datatype let_type;        // One LET item: x, y, z and mass.
+
+  std::vector<float> q[7];      // x, y, z, vx, vy, vz and mass.
+  std::vector<float> cost;      // Interactions of the previous step.
+  std::vector<size_t> id;       // Index in the global arrays.
+
+  std::vector<float> src[4];    // Owned particles then LET: x, y, z, mass.
+  std::vector<float> acc[3];
+  std::vector<unsigned> work;
+  bh_tree tree;
+
+  double imbalance;             // Largest over mean work of the last step.
+  double imbalance_sum;         // Sum of imbalance over the steps.
+  double imbalance_max;         // Largest imbalance of any step.
+  size_t steps;                 // Steps taken by orb_step().
+  size_t let_items;             // LET cells and particles received.
+  size_t migrated;              // Particles that changed rank.
+  double force_time;            // Seconds in tree builds and walks.
+  double comm_time;             // Seconds partitioning, migrating and in LETs.
+};
+
+/*
+* The initial share of rank of nranks: global particles first..first+count-1.
+*/
+extern void orb_share(size_t npart, int nranks, int rank, size_t *first,
+  size_t *count);
+
+/*
+* Take this rank's initial share, count particles with global indices from
+* first on, at unit cost; no rank needs the other shares. The first
+* orb_step() then moves them to their ORB domains.
+*/
+extern void orb_init(orb_state &orb, MPI_Comm comm, const float lo[3],
+  const float hi[3], size_t first, size_t count, const float *px,
+  const float *py, const float *pz, const float *vx, const float *vy,
+  const float *vz, const float *mass);
+
+extern void orb_free(orb_state &orb);
+
+/*
+* One Euler step of dt. The box lo..hi is first re-cut so that each rank's
+* domain holds an equal share of the interaction cost of the previous step,
+* and every particle is sent to the rank whose domain contains it. Planes
+* are found from weighted histograms of the coordinates, reduced over all
+* ranks for every node of a tree level at once.
+* Each rank then sends every other rank the locally essential part of its
+* tree: the cells that rank's whole domain accepts under the opening
+* criterion, and the particles of leaves it opens. It walks a tree of its
+* particles and the received LET, recording the interactions of each
+* particle as its cost for the next step.
+*/
+extern void orb_step(orb_state &orb, float G, float eps, float theta,
+  float dt);
+
+/*
+* Write every rank's particles into the global arrays of rank root, which
+* must hold all npart particles; the arrays of other ranks are not used.
+* Root receives one rank at a time, so it needs no more than its arrays and
+* one rank's particles. Meant for checks on moderate runs only.
+*/
+extern void orb_gather(orb_state &orb, int root, float *px, float *py,
+  float *pz, float *vx, float *vy, float *vz);
+
+#endif // MPI_ORB_H_INCLUDED
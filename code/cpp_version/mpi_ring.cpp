@@ -0,0 +1,216 @@
+/**
+* Systolic direct sum: each rank keeps its own particles and the j-data
+* (positions and masses) of every rank passes once around a ring.
+*/
+
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "mpi_ring.h"
+
+#define RING_TAG 17
+
+void
+ring_partition(size_t npart, int nranks, int rank, size_t *first,
+  size_t *count)
+{
+  size_t r = rank;
+  size_t base = npart/nranks;
+  size_t extra = npart%nranks;
+  *first = r*base + (r < extra ? r : extra);
+  *count = base + (r < extra ? 1 : 0);
+}
+
+void
+ring_init(ring_state &ring, MPI_Comm comm, size_t npart, int comm_mode)
+{
+  ring.comm = comm;
+  MPI_Comm_rank(comm, &ring.rank);
+  MPI_Comm_size(comm, &ring.nranks);
+  ring.npart = npart;
+  ring_partition(npart, ring.nranks, ring.rank, &ring.first, &ring.count);
+  ring.max_count = (npart + ring.nranks - 1)/ring.nranks;
+
+  // Each block holds x, y, z and mass in segments of max_count floats.
+  ring.block[0].assign(4*ring.max_count, 0.0f);
+  ring.block[1].assign(4*ring.max_count, 0.0f);
+  ring.comm_mode = comm_mode;
+  ring.compute_time = 0;
+  ring.comm_time = 0;
+  ring.messages = 0;
+}
+
+/*
+* Add the accelerations from the nj particles of block b to the owned
+* particles i0..i1-1. If self is set, b holds the owned particles
+* themselves and each particle skips its own entry.
+*/
+static void
+ring_block(ring_state &ring, const float *b, size_t nj, bool self,
+  size_t i0, size_t i1, const float *px, const float *py, const float *pz,
+  float *ax, float *ay, float *az, float G, float eps)
+{
+  const float *bx = b;
+  const float *by = b + ring.max_count;
+  const float *bz = b + 2*ring.max_count;
+  const float *bm = b + 3*ring.max_count;
+
+  for (size_t i = i0; i < i1; ++i) {
+    float xi = px[i], yi = py[i], zi = pz[i];
+    float axi = 0, ayi = 0, azi = 0;
+
+    #pragma omp simd reduction(+:axi,ayi,azi)
+    for (size_t j = 0; j < nj; ++j) {
+      float dx = bx[j] - xi;
+      float dy = by[j] - yi;
+      float dz = bz[j] - zi;
+      float d = sqrtf(dx*dx + dy*dy + dz*dz) + eps;
+      float s = self && j == i ? 0 : G*bm[j]/(d*d*d);
+      axi += s*dx;
+      ayi += s*dy;
+      azi += s*dz;
+    }
+
+    ax[i] += axi;
+    ay[i] += ayi;
+    az[i] += azi;
+  }
+}
+
+void
+ring_accelerations(ring_state &ring,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps)
+{
+  size_t n = ring.count;
+
+  float *own = &ring.block[0][0];
+  for (size_t i = 0; i < n; ++i) {
+    own[i] = px[i];
+    own[ring.max_count + i] = py[i];
+    own[2*ring.max_count + i] = pz[i];
+    own[3*ring.max_count + i] = mass[i];
+    ax[i] = 0;
+    ay[i] = 0;
+    az[i] = 0;
+  }
+
+  int left = (ring.rank + ring.nranks - 1)%ring.nranks;
+  int right = (ring.rank + 1)%ring.nranks;
+  int size = 4*ring.max_count;
+  int cur = 0;
+#ifdef _OPENMP
+  int nthreads = omp_get_max_threads();
+#else
+  int nthreads = 1;
+#endif
+
+  for (int hop = 0; hop < ring.nranks; ++hop) {
+    // The block in hand started at rank (rank - hop) mod P.
+    int origin = (ring.rank + ring.nranks - hop)%ring.nranks;
+    size_t first, nj;
+    ring_partition(ring.npart, ring.nranks, origin, &first, &nj);
+    const float *b = &ring.block[cur][0];
+    bool more = hop < ring.nranks - 1;
+    MPI_Request req[2];
+    ring.messages += more;
+
+    if (nthreads == 1) {
+      double t0 = MPI_Wtime();
+      if (more) {
+        MPI_Irecv(&ring.block[1 - cur][0], size, MPI_FLOAT, left, RING_TAG,
+          ring.comm, &req[0]);
+        MPI_Isend(&ring.block[cur][0], size, MPI_FLOAT, right, RING_TAG,
+          ring.comm, &req[1]);
+      }
+      double t1 = MPI_Wtime();
+
+      ring_block(ring, b, nj, hop == 0, 0, n, px, py, pz, ax, ay, az, G, eps);
+      double t2 = MPI_Wtime();
+
+      if (more) {
+        MPI_Waitall(2, req, MPI_STATUSES_IGNORE);
+      }
+      double t3 = MPI_Wtime();
+
+      ring.compute_time += t2 - t1;
+      ring.comm_time += (t1 - t0) + (t3 - t2);
+      cur = 1 - cur;
+      continue;
+    }
+
+    // Threads take chunks of owned particles. One of them first drives the
+    // messages of this hop, testing them without pause until both are
+    // complete, and only then takes chunks like the rest.
+    double t0 = MPI_Wtime();
+    double comm = 0;
+    size_t next = 0;
+#ifdef _OPENMP
+    int comm_thread = ring.comm_mode == RING_FUNNELED ? 0 : nthreads - 1;
+#endif
+    #pragma omp parallel num_threads(nthreads) reduction(+:comm)
+    {
+#ifdef _OPENMP
+      bool comm_role = more && omp_get_thread_num() == comm_thread;
+#else
+      bool comm_role = more;
+#endif
+      int done = !comm_role;
+      if (comm_role) {
+        double c0 = MPI_Wtime();
+        MPI_Irecv(&ring.block[1 - cur][0], size, MPI_FLOAT, left, RING_TAG,
+          ring.comm, &req[0]);
+        MPI_Isend(&ring.block[cur][0], size, MPI_FLOAT, right, RING_TAG,
+          ring.comm, &req[1]);
+        comm += MPI_Wtime() - c0;
+      }
+
+      while (!done) {
+        double c0 = MPI_Wtime();
+        MPI_Testall(2, req, &done, MPI_STATUSES_IGNORE);
+        comm += MPI_Wtime() - c0;
+      }
+
+      for (;;) {
+        size_t chunk;
+        #pragma omp atomic capture
+        chunk = next++;
+        size_t i0 = chunk*RING_CHUNK;
+        if (i0 >= n) {
+          break;
+        }
+        size_t i1 = i0 + RING_CHUNK < n ? i0 + RING_CHUNK : n;
+        ring_block(ring, b, nj, hop == 0, i0, i1, px, py, pz, ax, ay, az,
+          G, eps);
+      }
+    }
+
+    ring.compute_time += MPI_Wtime() - t0;
+    ring.comm_time += comm;
+    cur = 1 - cur;
+  }
+}
+
+void
+ring_gather(ring_state &ring, int root, float *x)
+{
+  std::vector<int> counts(ring.nranks), displs(ring.nranks);
+  for (int r = 0; r < ring.nranks; ++r) {
+    size_t first, count;
+    ring_partition(ring.npart, ring.nranks, r, &first, &count);
+    counts[r] = count;
+    displs[r] = first;
+  }
+
+  if (ring.rank == root) {
+    // The root's own slice already sits at its global offset.
+    MPI_Gatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, x, &counts[0],
+      &displs[0], MPI_FLOAT, root, ring.comm);
+  } else {
+    MPI_Gatherv(x, counts[ring.rank], MPI_FLOAT, NULL, NULL, NULL,
+      MPI_FLOAT, root, ring.comm);
+  }
+}
@@ -0,0 +1,72 @@
+/* Direct sum distributed over a ring of MPI ranks. */
+#ifndef MPI_RING_H_INCLUDED
+#define MPI_RING_H_INCLUDED
+
+#include <mpi.h>
+#include <stddef.h>
+#include <vector>
+
+// Which thread of a rank makes the MPI calls of the threaded ring.
+#define RING_FUNNELED 0         // The master thread (MPI_THREAD_FUNNELED).
+#define RING_SERIALIZED 1       // The last thread (MPI_THREAD_SERIALIZED).
+
+// Owned particles per unit of work handed to a thread.
+#define RING_CHUNK 64
+
+/*
+* A rank's share of the particles and the buffers of the ring. Rank r owns
+* the contiguous range [first, first + count) of the global particles and
+* holds only those, plus the two blocks in flight.
+*/
+struct ring_state {
+  MPI_Comm comm;
+  int rank;
+  int nranks;
+  size_t npart;                 // Particles over all ranks.
+  size_t first;                 // First particle owned by this rank.
+  size_t count;                 // Particles owned by this rank.
+  size_t max_count;             // Largest count of any rank.
+  std::vector<float> block[2];  // j-blocks in flight: x, y, z and mass.
+  int comm_mode;                // RING_FUNNELED or RING_SERIALIZED.
+  double compute_time;          // Seconds in the force loop.
+  double comm_time;             // Seconds in MPI calls for the ring.
+  size_t messages;              // Blocks sent by this rank.
+};
+
+/*
+* The contiguous range of npart particles owned by rank out of nranks, with
+* counts differing by at most one.
+*/
+extern void ring_partition(size_t npart, int nranks, int rank,
+  size_t *first, size_t *count);
+
+extern void ring_init(ring_state &ring, MPI_Comm comm, size_t npart,
+  int comm_mode = RING_FUNNELED);
+
+/*
+* Accelerations of the owned particles, reading only the owned positions
+* and masses. The j-blocks travel P - 1 hops around the ring: while the
+* block received on the previous hop is summed into the owned particles,
+* it is already being sent to the right neighbour and the next one is being
+* received from the left, so communication overlaps the force loop.
+* Arrays hold the count owned particles only, from index 0.
+*
+* With more than one OpenMP thread, one thread makes all MPI calls of a hop
+* and acts as its progress thread: it tests the messages continuously while
+* the other threads work through the block in chunks of RING_CHUNK
+* particles, and joins them once both messages are complete. comm_time is
+* then the time in MPI calls of that thread, overlapped with the force
+* loop, and compute_time the wall time of the threaded hops.
+*/
+extern void ring_accelerations(ring_state &ring,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps);
+
+/*
+* Collect the owned slices of every rank into x on root. x holds all npart
+* particles on root, whose own slice must already be at offset first, and
+* only the owned ones elsewhere.
+*/
+extern void ring_gather(ring_state &ring, int root, float *x);
+
+#endif // MPI_RING_H_INCLUDED
@@ -0,0 +1,242 @@
+/**
+* Parareal (Lions, Maday & Turinici 2001) around the Euler step of
+* update_particle_details().
+*
+* Each slice's fine solve owns its state, accelerations and tree, so the
+* slices run on std::thread workers without sharing anything writable. The
+* coarse sweep is inherently serial and is kept cheap by taking few steps and,
+* optionally, Barnes-Hut forces.
+*/
+
+#include <chrono>
+#include <functional>
+#include <math.h>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "barnes_hut.h"
+#include "direct.h"
+#include "parareal.h"
+
+// Tile sizes of the blocked direct sum used by both propagators.
+#define PARAREAL_TILE_I 64
+#define PARAREAL_TILE_J 1024
+
+/*
+* Positions and velocities of all particles at one slice boundary.
+*/
+struct pr_state {
+  std::vector<float> q[6];      // x, y, z, vx, vy, vz.
+};
+
+/*
+* Scratch space of one propagator.
+*/
+struct pr_work {
+  std::vector<float> a[3];
+  bh_tree tree;
+};
+
+static void
+pr_resize(pr_state &s, size_t npart)
+{
+  for (int k = 0; k < 6; ++k) {
+    s.q[k].resize(npart);
+  }
+}
+
+/*
+* Take nsteps Euler steps of dt from s, in place. If threads > 0, the force
+* loops of the calling thread use that many OpenMP threads; a std::thread
+* otherwise starts from the default team size, not the one of the run.
+*/
+static void
+propagate(pr_state &s, pr_work &w, size_t npart, size_t nsteps, float dt,
+  const float *mass, float G, float eps, float theta, int threads)
+{
+#ifdef _OPENMP
+  if (threads > 0) {
+    omp_set_num_threads(threads);
+  }
+#else
+  (void) threads;
+#endif
+  for (int k = 0; k < 3; ++k) {
+    w.a[k].resize(npart);
+  }
+  float *px = &s.q[0][0], *py = &s.q[1][0], *pz = &s.q[2][0];
+  float *vx = &s.q[3][0], *vy = &s.q[4][0], *vz = &s.q[5][0];
+  float *ax = &w.a[0][0], *ay = &w.a[1][0], *az = &w.a[2][0];
+
+  for (size_t step = 0; step < nsteps; ++step) {
+    if (theta > 0) {
+      bh_build(w.tree, npart, px, py, pz, mass);
+      bh_accelerations(w.tree, npart, px, py, pz, mass, ax, ay, az,
+        G, eps, theta);
+    } else {
+      direct_blocked_accelerations(npart, px, py, pz, mass, ax, ay, az,
+        G, eps, PARAREAL_TILE_I, PARAREAL_TILE_J);
+    }
+
+    for (size_t i = 0; i < npart; ++i) {
+      vx[i] += ax[i]*dt;
+      vy[i] += ay[i]*dt;
+      vz[i] += az[i]*dt;
+
+      px[i] += vx[i]*dt;
+      py[i] += vy[i]*dt;
+      pz[i] += vz[i]*dt;
+    }
+  }
+}
+
+static double
+seconds_since(std::chrono::high_resolution_clock::time_point t)
+{
+  return std::chrono::duration<double>(
+    std::chrono::high_resolution_clock::now() - t).count();
+}
+
+void
+parareal_run(const parareal_params &params, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  const float *mass, float G, float eps, parareal_stats *stats)
+{
+  size_t nslices = params.nslices;
+  size_t fine_steps = params.nsteps/nslices;
+  float slice_dt = fine_steps*params.dt;
+  float coarse_dt = slice_dt/params.coarse_steps;
+  float *init[6] = {px, py, pz, vx, vy, vz};
+
+  // u[n] is the state at the start of slice n; g[n + 1] and f[n + 1] are
+  // the coarse and fine propagations of u[n].
+  std::vector<pr_state> u(nslices + 1), g(nslices + 1), f(nslices + 1);
+  std::vector<pr_work> work(nslices);
+  pr_work coarse_work;
+  for (size_t n = 0; n <= nslices; ++n) {
+    pr_resize(u[n], npart);
+  }
+  for (int k = 0; k < 6; ++k) {
+    u[0].q[k].assign(init[k], init[k] + npart);
+  }
+
+  // Positions are compared against the extent of the initial state.
+  float lo = px[0], hi = px[0];
+  for (size_t i = 0; i < npart; ++i) {
+    lo = fminf(lo, fminf(px[i], fminf(py[i], pz[i])));
+    hi = fmaxf(hi, fmaxf(px[i], fmaxf(py[i], pz[i])));
+  }
+  double extent = hi > lo ? hi - lo : 1.0;
+
+  stats->iterations = 0;
+  stats->correction = 0;
+  stats->fine_time = 0;
+  stats->coarse_time = 0;
+
+  // Initial serial coarse sweep.
+  std::chrono::high_resolution_clock::time_point t0 =
+    std::chrono::high_resolution_clock::now();
+  for (size_t n = 0; n < nslices; ++n) {
+    g[n + 1] = u[n];
+    propagate(g[n + 1], coarse_work, npart, params.coarse_steps, coarse_dt,
+      mass, G, eps, params.theta, 0);
+    u[n + 1] = g[n + 1];
+  }
+  stats->coarse_time += seconds_since(t0);
+
+#ifdef _OPENMP
+  int cores = omp_get_max_threads();
+#else
+  int cores = 1;
+#endif
+
+  for (size_t k = 0; k < nslices && k < params.max_iter; ++k) {
+    // Fine solves of the unconverged slices k..nslices-1, in waves of
+    // nthreads workers that share the cores of the run between them.
+    t0 = std::chrono::high_resolution_clock::now();
+    for (size_t first = k; first < nslices; first += params.nthreads) {
+      size_t last = first + params.nthreads < nslices
+        ? first + params.nthreads : nslices;
+      int share = cores/(int) (last - first);
+      share = share > 0 ? share : 1;
+      std::vector<std::thread> workers;
+      for (size_t n = first; n < last; ++n) {
+        f[n + 1] = u[n];
+        workers.push_back(std::thread(propagate, std::ref(f[n + 1]),
+          std::ref(work[n]), npart, fine_steps, params.dt, mass, G, eps,
+          0.0f, share));
+      }
+      for (size_t w = 0; w < workers.size(); ++w) {
+        workers[w].join();
+      }
+    }
+    stats->fine_time += seconds_since(t0);
+
+    // Serial correction sweep. Slice k's start is exact, so its fine result
+    // is taken as is.
+    t0 = std::chrono::high_resolution_clock::now();
+    double correction = 0;
+    for (size_t n = k; n < nslices; ++n) {
+      pr_state gn = u[n];
+      if (n > k) {
+        propagate(gn, coarse_work, npart, params.coarse_steps, coarse_dt,
+          mass, G, eps, params.theta, 0);
+      }
+
+      for (int c = 0; c < 6; ++c) {
+        float *un = &u[n + 1].q[c][0];
+        const float *fn = &f[n + 1].q[c][0];
+        const float *gold = &g[n + 1].q[c][0];
+        const float *gnew = &gn.q[c][0];
+        for (size_t i = 0; i < npart; ++i) {
+          float next = n > k ? gnew[i] + fn[i] - gold[i] : fn[i];
+          if (c < 3) {
+            correction = fmax(correction, fabs(next - un[i])/extent);
+          }
+          un[i] = next;
+        }
+      }
+      if (n > k) {
+        g[n + 1] = gn;
+      }
+    }
+    stats->coarse_time += seconds_since(t0);
+
+    stats->iterations = k + 1;
+    stats->correction = correction;
+    if (correction < params.tol) {
+      break;
+    }
+  }
+
+  for (int k = 0; k < 6; ++k) {
+    for (size_t i = 0; i < npart; ++i) {
+      init[k][i] = u[nslices].q[k][i];
+    }
+  }
+}
+
+void
+parareal_serial(const parareal_params &params, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  const float *mass, float G, float eps)
+{
+  float *init[6] = {px, py, pz, vx, vy, vz};
+  pr_state s;
+  pr_work w;
+  for (int k = 0; k < 6; ++k) {
+    s.q[k].assign(init[k], init[k] + npart);
+  }
+
+  propagate(s, w, npart, params.nsteps, params.dt, mass, G, eps, 0.0f, 0);
+
+  for (int k = 0; k < 6; ++k) {
+    for (size_t i = 0; i < npart; ++i) {
+      init[k][i] = s.q[k][i];
+    }
+  }
+}
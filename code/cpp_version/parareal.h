@@ -0,0 +1,55 @@
+/* Parareal parallel-in-time integration. */
+#ifndef PARAREAL_H_INCLUDED
+#define PARAREAL_H_INCLUDED
+
+#include <stddef.h>
+
+/*
+* Settings of a Parareal run. The time span nsteps*dt is cut into nslices
+* slices. The fine propagator takes the slice's nsteps/nslices Euler steps of
+* dt with the direct sum; the coarse one takes coarse_steps Euler steps over
+* the slice, with Barnes-Hut forces when theta > 0 and the direct sum
+* otherwise.
+*/
+struct parareal_params {
+  size_t nsteps;                // Fine steps over the whole run.
+  float dt;                     // Fine step.
+  size_t nslices;               // Time slices, one fine solve per worker.
+  size_t coarse_steps;          // Coarse steps per slice.
+  float theta;                  // Coarse Barnes-Hut opening angle, 0 for direct.
+  float tol;                    // Convergence tolerance on the correction.
+  size_t max_iter;              // Upper bound on the iterations.
+  size_t nthreads;              // Worker threads for the fine solves.
+};
+
+/*
+* Statistics of a Parareal run.
+*/
+struct parareal_stats {
+  size_t iterations;            // Parareal iterations performed.
+  double correction;            // Last largest position correction.
+  double fine_time;             // Wall time in the fine solves, in seconds.
+  double coarse_time;           // Wall time in the coarse solves, in seconds.
+};
+
+/*
+* Advance the particles by nsteps*dt with Parareal. Each iteration runs the
+* fine propagator on all unconverged slices concurrently on worker threads,
+* then sweeps the slices in order applying U[n+1] = G(U[n]) + F(U_old[n]) -
+* G(U_old[n]). It stops when the largest position change of a sweep,
+* relative to the extent of the system, is below tol; after k iterations the
+* first k slices equal the serial fine solution exactly.
+*/
+extern void parareal_run(const parareal_params &params, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  const float *mass, float G, float eps, parareal_stats *stats);
+
+/*
+* The fine propagator alone, run serially over the whole span, for checking
+* parareal_run() against the answer it converges to.
+*/
+extern void parareal_serial(const parareal_params &params, size_t npart,
+  float *px, float *py, float *pz, float *vx, float *vy, float *vz,
+  const float *mass, float G, float eps);
+
+#endif // PARAREAL_H_INCLUDED
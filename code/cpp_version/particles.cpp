@@ -14,11 +14,39 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <thread>
 #include <time.h>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef USE_MPI
+#include <mpi.h>
+#include <sys/resource.h>
+#endif
 
 // User defined header files.
+#include "barnes_hut.h"
+#include "blocksteps.h"
+#include "cells.h"
+#include "direct.h"
+#include "engine.h"
+#include "fmm.h"
+#include "hermite.h"
+#ifdef USE_MPI
+#include "mpi_orb.h"
+#include "mpi_ring.h"
+#endif
+#include "parareal.h"
 #include "particles.h"
+#include "placement.h"
+#include "pm.h"
+#include "sfc.h"
+#include "treepm.h"
 #include "utils.h"
+#include "worksteal.h"
 
 // User defined macros.
 // #define DEBUGGING 1
@@ -28,15 +56,66 @@
 #define DEFAULT_HEIGHT 512
 #define DEFAULT_DEPTH 512
 #define DEFAULT_DELTA_T 1e2
+#define DEFAULT_THETA 0.5
+#define DEFAULT_FMM_ORDER 4
+#define DEFAULT_MESH_X 64
+#define DEFAULT_MESH_Y 32
+#define DEFAULT_MESH_Z 32
+#define DEFAULT_ASMTH 1.25
+#define DEFAULT_TREEPM_RCUT 4.5
+#define DEFAULT_RCUT 64
+#define DEFAULT_SKIN 8
+#define DEFAULT_BLOCK_ETA 0.025
+#define DEFAULT_SFC_EVERY 10
+// Relative distance to t_end within which an adaptive step is stretched to
+// end there, so that float rounding of delta_t leaves no sliver step.
+#define T_END_TOL 1e-6
+
+// Force evaluation modes.
+#define FORCE_DIRECT 0
+#define FORCE_BH 1
+#define FORCE_FMM 2
+#define FORCE_PM 3
+#define FORCE_TREEPM 4
+#define FORCE_P3M 5
+#define FORCE_DIRECT_SYM 6
+#define FORCE_DIRECT_BLOCKED 7
+#define FORCE_DIRECT_SIMD 8
+#define FORCE_DIRECT_MIXED 9
+#define FORCE_CUTOFF 10
+#define FORCE_VERLET 11
+#define FORCE_RING 12
+#define FORCE_ORB 13
+
+// Time integrators.
+#define INTEGRATOR_EULER 0
+#define INTEGRATOR_KDK 1
+#define INTEGRATOR_YOSHIDA 2
+#define INTEGRATOR_HERMITE 3
 
 // Namespaces.
 using namespace std;
 using namespace std::chrono; // For timing.
 
 static int write_all_particle_details_to_file(string filename);
+static void compute_accelerations();
+static void compute_direct_accelerations();
+static void check_force_error();
+static void respa_step();
+static void symplectic_step();
+static double total_energy();
+static void choose_step();
+static double run_parareal();
+static void reorder_particles();
+static int set_schedule(const char *name);
+static int init_threads();
+static void report_scaling();
 static const string PDPATH = "./particle_positions/";
 
 static size_t npart = DEFAULT_NPART;
+static size_t first_held = 0;          // Global index of the first array entry.
+static size_t nheld = 0;               // Particles in the arrays: npart, or
+                                       // the rank's share under force=orb.
 static size_t nsteps = DEFAULT_NSTEPS;
 static float size_x = DEFAULT_WIDTH;
 static float size_y = DEFAULT_HEIGHT;
@@ -54,6 +133,75 @@ static float delta_t = DEFAULT_DELTA_T;
 static float scale_mass = 1.0e6;
 static float G = 6.67384e-11;
 
+static int force_mode = FORCE_DIRECT;  // How accelerations are computed.
+static float theta = DEFAULT_THETA;    // Barnes-Hut/FMM opening angle.
+static int fmm_order = DEFAULT_FMM_ORDER; // Order of the FMM expansions.
+static int mesh_x = DEFAULT_MESH_X;    // PM mesh points along x.
+static int mesh_y = DEFAULT_MESH_Y;    // PM mesh points along y.
+static int mesh_z = DEFAULT_MESH_Z;    // PM mesh points along z.
+static int assign = PM_CIC;            // PM mass assignment scheme.
+static float asmth = DEFAULT_ASMTH;    // TreePM split scale, in mesh cells.
+static float treepm_rcut = DEFAULT_TREEPM_RCUT; // Short-range cutoff, in split scales.
+static float rcut = DEFAULT_RCUT;      // Cutoff radius of FORCE_CUTOFF/VERLET.
+static float skin = DEFAULT_SKIN;      // Verlet list skin beyond rcut.
+static float verlet_moved = 0;         // Largest displacement since the build.
+static bool verlet_stale = false;      // Lists index an older particle order.
+static int block_levels = 1;           // Step bins, 1 for a single global step.
+static float block_eta = DEFAULT_BLOCK_ETA; // Block step accuracy parameter.
+static int integrator = INTEGRATOR_EULER; // Time integration scheme.
+static bool have_acc = false;          // Accelerations match the positions.
+static size_t force_evals = 0;         // Calls of compute_accelerations().
+static int energy_check = 0;           // Report the relative energy error.
+static float t_end = 0;                // End time, 0 to run nsteps steps.
+static float dt_eta = 0;               // Adaptive step accuracy, 0 for fixed.
+static float dt_max = 0;               // Largest adaptive step (delta_t).
+static double sim_time = 0;            // Simulated time so far.
+static bool final_step = false;        // The step was fitted to end at t_end.
+static size_t parareal_slices = 0;     // Parareal time slices, 0 for none.
+static size_t parareal_coarse = 1;     // Coarse steps per slice.
+static float parareal_theta = DEFAULT_THETA; // Coarse Barnes-Hut angle.
+static float parareal_tol = 1e-6;      // Parareal convergence tolerance.
+static size_t parareal_threads = 0;    // Fine solve workers, 0 for all cores.
+static int parareal_check = 0;         // Compare with the serial fine run.
+static int nthreads = 0;               // OpenMP threads, 0 for the default.
+static char schedule_name[32] = "static"; // OpenMP schedule of the loops.
+static size_t scaling = 0;             // Steps timed per thread count.
+static int numa_policy = PLACE_FIRST_TOUCH; // Placement of positions and mass.
+static int affinity = AFFINITY_NONE;   // Pinning of the OpenMP threads.
+static int sfc_curve = SFC_NONE;       // Curve the particles are sorted along.
+static size_t sfc_every = DEFAULT_SFC_EVERY; // Steps between reorderings.
+static size_t sfc_reorders = 0;        // Reorderings so far.
+static double sfc_time = 0;            // Time spent reordering, in ms.
+static int steal = 0;                  // Tree and cell passes by work stealing.
+static size_t respa_k = 0;             // Fast sub-steps per slow step, 0 for none.
+static size_t respa_sub = 0;           // Fast sub-steps taken in this slow step.
+static size_t respa_slow_evals = 0;    // Slow force evaluations so far.
+static size_t respa_fast_evals = 0;    // Fast force evaluations so far.
+static size_t tile_i = 0;              // Blocked kernel i-tile, 0 to autotune.
+static size_t tile_j = 0;              // Blocked kernel j-tile, 0 to autotune.
+static char simd_name[16] = "auto";   // Requested SIMD instruction set.
+static int simd_isa = SIMD_SCALAR;     // Instruction set actually used.
+static int simd_nr = 1;                // Newton-Raphson steps after rsqrt/rcp.
+static int softening = SOFT_LEGACY;    // Softening kernel of the force law.
+static size_t force_check = 0;         // Particles sampled for the error check.
+static double force_err_rms = 0;       // Largest sampled RMS relative error.
+static double force_err_max = 0;       // Largest sampled relative error.
+
+static bh_tree tree;                   // Octree used by FORCE_BH.
+static cell_list cells;                // Cell lists used by FORCE_CUTOFF.
+static verlet_list verlet;             // Neighbour lists used by FORCE_VERLET.
+static block_state blocks;             // Step bins when block_levels > 1.
+static hermite_state hermite;          // Jerks and start-of-step state.
+static sfc_state sfc;                  // Keys and permutation of the last reorder.
+static ws_pool pool;                   // Workers of the work-stealing passes.
+static ws_pool *tasks = NULL;          // &pool if steal is set, else NULL.
+#ifdef USE_MPI
+static ring_state ring;                // Owned particles of FORCE_RING.
+static orb_state orb;                  // Domains and particles of FORCE_ORB.
+static int mpi_thread = RING_FUNNELED; // Thread making the ring's MPI calls.
+static int mpi_provided = MPI_THREAD_SINGLE; // Thread support of the library.
+#endif
+
 static float * pxvec;      // Vector of particle x positions.
 static float * pyvec;      // Vector of particle y positions.
 static float * pzvec;      // Vector of particle z positions.
@@ -68,6 +216,35 @@ static float * azvec;      // Vector of particle acceleration z components.
 
 static float * massvec;    // Vector of particle masses.
 
+static size_t * idvec;     // Vector of particle ids, their initial indices.
+
+// Double precision state, only allocated for FORCE_DIRECT_MIXED. The float
+// vectors above then hold rounded copies for output.
+static double * pxdvec;    // Vector of particle x positions.
+static double * pydvec;    // Vector of particle y positions.
+static double * pzdvec;    // Vector of particle z positions.
+
+static double * vxdvec;    // Vector of particle velocity x components.
+static double * vydvec;    // Vector of particle velocity y components.
+static double * vzdvec;    // Vector of particle velocity z components.
+
+static double * axdvec;    // Vector of particle acceleration x components.
+static double * aydvec;    // Vector of particle acceleration y components.
+static double * azdvec;    // Vector of particle acceleration z components.
+
+// Force split, only allocated when respa_k > 0: the fast (near-field) part
+// of the acceleration and the slow remainder.
+static float * fxvec;      // Vector of fast acceleration x components.
+static float * fyvec;      // Vector of fast acceleration y components.
+static float * fzvec;      // Vector of fast acceleration z components.
+
+static float * sxvec;      // Vector of slow acceleration x components.
+static float * syvec;      // Vector of slow acceleration y components.
+static float * szvec;      // Vector of slow acceleration z components.
+
+// The vectors above seen by the engine's direct sum, Euler step and writer.
+static engine_state<3> state;
+
 /*
 * Print expected usage of this program.
 */
@@ -79,25 +256,248 @@ print_usage()
   << "[depth=box_depth] "
   << "[npart=number_of_particles] "
   << "[delta_t=inter_frame_interval_in_seconds] "
-  << "[nsteps=number_of_steps]\n";
+  << "[integrator=euler|kdk|yoshida|hermite] "
+  << "[nsteps=number_of_steps] "
+  << "[t_end=end_time] "
+  << "[dt_eta=adaptive_step_accuracy] "
+  << "[force=direct|direct_sym|direct_blocked|direct_simd|direct_mixed|"
+  << "bh|fmm|pm|treepm|p3m|cutoff|verlet"
+#ifdef USE_MPI
+  << "|ring|orb"
+#endif
+  << "] "
+  << "[tile_i=i_block_size] "
+  << "[tile_j=j_block_size] "
+  << "[simd=auto|avx512|avx2|scalar] "
+  << "[simd_nr=newton_raphson_steps] "
+  << "[theta=opening_angle] "
+  << "[fmm_order=expansion_order] "
+  << "[mesh_x=mesh_width] "
+  << "[mesh_y=mesh_height] "
+  << "[mesh_z=mesh_depth] "
+  << "[assign=cic|tsc] "
+  << "[asmth=split_scale_in_mesh_cells] "
+  << "[treepm_rcut=cutoff_in_split_scales] "
+  << "[rcut=cutoff_radius] "
+  << "[skin=verlet_skin] "
+  << "[block_levels=number_of_step_bins] "
+  << "[block_eta=step_accuracy] "
+  << "[respa=fast_substeps_per_slow_step] "
+  << "[parareal=time_slices] "
+  << "[parareal_coarse=coarse_steps_per_slice] "
+  << "[parareal_theta=coarse_opening_angle] "
+  << "[parareal_tol=tolerance] "
+  << "[parareal_threads=workers] "
+  << "[parareal_check=0|1] "
+  << "[threads=number_of_threads] "
+  << "[schedule=static|dynamic|guided[,chunk]] "
+  << "[scaling=steps_per_thread_count] "
+  << "[numa=first_touch|interleave] "
+  << "[affinity=none|compact|scatter] "
+  << "[sfc=none|morton|hilbert] "
+  << "[sfc_every=steps_between_reorderings] "
+  << "[steal=0|1] "
+#ifdef USE_MPI
+  << "[mpi_thread=funneled|serialized] "
+#endif
+  << "[softening=legacy|plummer|spline|none] "
+  << "[force_check=num_sampled_particles] "
+  << "[energy_check=0|1]\n";
 }
 
-int main(int argc, char *argv[]) {
+static int simulate(int argc, char *argv[]) {
+
+  // Do all necessary initializations. The threads are set up first so that
+  // init_particles() touches the pages as the compute loops will use them.
+  if (!init_params(argc, argv) || !init_threads() || !init_particles()) {
+    return -1;
+  }
+
+#ifdef USE_MPI
+  // Every rank generates the same initial state; only rank 0 reports.
+  ring_init(ring, MPI_COMM_WORLD, npart, mpi_thread);
+  if (ring.rank != 0) {
+    cout.setstate(ios_base::badbit);
+  }
+  if ((force_mode == FORCE_RING || force_mode == FORCE_ORB)
+    && (integrator != INTEGRATOR_EULER || respa_k > 0 || block_levels > 1
+    || dt_eta > 0 || parareal_slices > 0 || force_check > 0
+    || sfc_curve != SFC_NONE)) {
+    cerr << "force=ring and force=orb require integrator=euler and no "
+    << "respa, block_levels, dt_eta, parareal, force_check or sfc\n";
+    return -1;
+  }
+#ifdef _OPENMP
+  int needed = mpi_thread == RING_FUNNELED ? MPI_THREAD_FUNNELED
+    : MPI_THREAD_SERIALIZED;
+  if (force_mode == FORCE_RING && omp_get_max_threads() > 1
+    && mpi_provided < needed) {
+    cerr << "The MPI library does not support mpi_thread="
+    << (mpi_thread == RING_FUNNELED ? "funneled" : "serialized") << "\n";
+    return -1;
+  }
+#endif
+  if (force_mode == FORCE_ORB) {
+    // Bisect the region the particles start in.
+    float lo[3] = {center_x - scale_x/2, center_y - scale_y/2,
+      center_z - scale_z/2};
+    float hi[3] = {center_x + scale_x/2, center_y + scale_y/2,
+      center_z + scale_z/2};
+    size_t first, count;
+    orb_share(npart, ring.nranks, ring.rank, &first, &count);
+    size_t k = first - first_held;
+    orb_init(orb, MPI_COMM_WORLD, lo, hi, first, count, pxvec + k, pyvec + k,
+      pzvec + k, vxvec + k, vyvec + k, vzvec + k, massvec + k);
+  }
+#endif
+
+  if (respa_k > 0 && (block_levels > 1 || force_mode == FORCE_DIRECT_MIXED)) {
+    cerr << "respa cannot be combined with block_levels or force=direct_mixed\n";
+    return -1;
+  }
+
+  if (integrator != INTEGRATOR_EULER && (respa_k > 0 || block_levels > 1
+    || force_mode == FORCE_DIRECT_MIXED)) {
+    cerr << "integrator cannot be combined with respa, block_levels "
+    << "or force=direct_mixed\n";
+    return -1;
+  }
+
+  if (dt_eta > 0 && (integrator == INTEGRATOR_HERMITE || respa_k > 0
+    || block_levels > 1)) {
+    cerr << "dt_eta cannot be combined with integrator=hermite, respa "
+    << "or block_levels\n";
+    return -1;
+  }
+  if (dt_eta > 0 && t_end <= 0) {
+    cerr << "dt_eta requires t_end\n";
+    return -1;
+  }
+  dt_max = delta_t;
+
+  // With a fixed step, run to t_end in whole steps of delta_t.
+  if (t_end > 0 && dt_eta <= 0) {
+    nsteps = (size_t) ceil(t_end/delta_t);
+  }
+
+  if (parareal_slices > 0) {
+    // The fine propagator is the direct sum with the Euler step.
+    if (force_mode != FORCE_DIRECT || integrator != INTEGRATOR_EULER
+      || respa_k > 0 || block_levels > 1 || dt_eta > 0
+      || sfc_curve != SFC_NONE || nsteps % parareal_slices != 0) {
+      cerr << "parareal requires force=direct, integrator=euler, no respa, "
+      << "block_levels, dt_eta or sfc, and nsteps divisible by parareal\n";
+      return -1;
+    }
+  }
+
+  if (integrator == INTEGRATOR_HERMITE) {
+    // Jerks come from the fused direct-sum kernel.
+    if (force_mode != FORCE_DIRECT) {
+      cerr << "integrator=hermite requires force=direct\n";
+      return -1;
+    }
+    hermite_init(hermite, npart);
+  }
+
+  if (block_levels > 1) {
+    // Active particles are summed directly against all sources.
+    if (force_mode != FORCE_DIRECT) {
+      cerr << "block_levels requires force=direct\n";
+      return -1;
+    }
+    block_init(blocks, npart, block_levels);
+  }
+
+  if (softening != SOFT_LEGACY && (integrator == INTEGRATOR_HERMITE
+    || block_levels > 1 || parareal_slices > 0
+    || (force_mode != FORCE_DIRECT && force_mode != FORCE_DIRECT_BLOCKED
+    && force_mode != FORCE_CUTOFF && force_mode != FORCE_VERLET))) {
+    // The other kernels keep the legacy law built in.
+    cerr << "softening requires force=direct, direct_blocked, cutoff or "
+    << "verlet, and no integrator=hermite, block_levels or parareal\n";
+    return -1;
+  }
 
-  // Do all necessary initializations.
-  if (!init_params(argc, argv) || !init_particles()) {
+  if (force_mode == FORCE_DIRECT_BLOCKED && (tile_i == 0 || tile_j == 0)) {
+    size_t ti, tj;
+    direct_blocked_autotune(npart, pxvec, pyvec, pzvec, massvec, G, eps,
+      &ti, &tj, softening);
+    tile_i = tile_i ? tile_i : ti;
+    tile_j = tile_j ? tile_j : tj;
+    cout << "tile_i=" << tile_i << " tile_j=" << tile_j << "\n";
+  }
+
+  if (force_mode == FORCE_DIRECT_SIMD) {
+    simd_isa = direct_simd_select(simd_name);
+    if (simd_isa < 0) {
+      cerr << "simd=" << simd_name << " is not supported on this CPU\n";
+      return -1;
+    }
+    cout << "simd=" << (simd_isa == SIMD_AVX512 ? "avx512"
+      : simd_isa == SIMD_AVX2 ? "avx2" : "scalar")
+    << " simd_nr=" << simd_nr << "\n";
+  }
+
+#ifdef _OPENMP
+  cout << "threads=" << omp_get_max_threads() << " schedule=" << schedule_name
+  << "\n";
+#endif
+#ifdef USE_NUMA
+  placement_report_threads();
+  const char *names[10] = {"px", "py", "pz", "vx", "vy", "vz", "ax", "ay",
+    "az", "mass"};
+  float *arrays[10] = {pxvec, pyvec, pzvec, vxvec, vyvec, vzvec, axvec, ayvec,
+    azvec, massvec};
+  for (int k = 0; k < 10; ++k) {
+    placement_report(names[k], arrays[k], npart);
+  }
+#endif
+  if (scaling > 0 && parareal_slices > 0) {
+    cerr << "scaling cannot be combined with parareal\n";
     return -1;
   }
 
+  // Under force=orb only rank 0 holds all particles, and only for this check.
+  double energy0 = energy_check && nheld == npart ? total_energy() : 0;
+
   double avg_cpu_time = 0;
-  for(size_t i = 0; i < nsteps; i++) {
+  double dt_min_used = dt_max, dt_max_used = 0;
+  size_t steps_taken = 0;
+  if (parareal_slices > 0) {
+    avg_cpu_time = run_parareal();
+    sim_time = nsteps*delta_t;
+    steps_taken = nsteps;
+  }
+  for(size_t i = 0; parareal_slices > 0 ? false
+    : dt_eta > 0 ? sim_time < t_end : i < nsteps; i++) {
+    if (sfc_curve != SFC_NONE && i % sfc_every == 0) {
+      reorder_particles();
+    }
+
     high_resolution_clock::time_point t1 = high_resolution_clock::now();
     update_particle_details();
     high_resolution_clock::time_point t2 = high_resolution_clock::now();
 
+    // delta_t is the step just taken, which varies in adaptive mode. The
+    // step fitted to t_end ends exactly there, and its length says nothing
+    // about the step control, so it is left out of the statistics unless
+    // it is the only one.
+    sim_time += delta_t;
+    if (final_step) {
+      sim_time = t_end;
+    } else {
+      dt_min_used = delta_t < dt_min_used ? delta_t : dt_min_used;
+      dt_max_used = delta_t > dt_max_used ? delta_t : dt_max_used;
+    }
+    if (final_step && steps_taken == 0) {
+      dt_min_used = dt_max_used = delta_t;
+    }
+    ++steps_taken;
+
     // Add current duration to average, to be later divided by number of cycles,
     // which is the number of times update_particles() is called.
-    avg_cpu_time += duration_cast<milliseconds>( t2 - t1 ).count();
+    avg_cpu_time += duration_cast<microseconds>(t2 - t1).count()*1e-3;
 
     // Write file with all particle details in current frame.
     // string filename("positions_" + to_string(i) + ".vtk");
@@ -107,51 +507,224 @@ int main(int argc, char *argv[]) {
     // }
   }
 
+#ifdef USE_MPI
+  if (force_mode == FORCE_RING && energy_check) {
+    float *state[6] = {pxvec, pyvec, pzvec, vxvec, vyvec, vzvec};
+    for (int k = 0; k < 6; ++k) {
+      ring_gather(ring, 0, state[k]);
+    }
+  }
+  if (force_mode == FORCE_ORB && energy_check) {
+    orb_gather(orb, 0, pxvec, pyvec, pzvec, vxvec, vyvec, vzvec);
+  }
+#endif
+
   #pragma acc exit data
 
   // Calculate average duration.
-  avg_cpu_time /= nsteps;
+  avg_cpu_time /= steps_taken > 0 ? steps_taken : 1;
   cout << "avg_cpu_time for update_particles() in ms=" << avg_cpu_time << "\n";
 
-  delete [] pxvec;
-  delete [] pyvec;
-  delete [] pzvec;
+  if ((force_mode == FORCE_DIRECT || force_mode == FORCE_DIRECT_SYM
+    || force_mode == FORCE_DIRECT_BLOCKED || force_mode == FORCE_DIRECT_SIMD
+    || force_mode == FORCE_DIRECT_MIXED) && block_levels == 1
+    && parareal_slices == 0 && respa_k == 0
+    && avg_cpu_time > 0) {
+    // Pairwise interactions, counting i->j and j->i separately. A RESPA
+    // step evaluates the full sum only once per respa_k steps.
+    double interactions = (double) npart*(npart - 1);
+    cout << "interactions_per_second=" << interactions/(avg_cpu_time*1e-3)
+    << "\n";
+  }
 
-  delete [] vxvec;
-  delete [] vyvec;
-  delete [] vzvec;
+  if (block_levels > 1) {
+    // Per-bin particle counts at the end of the run and per-particle force
+    // evaluations over the whole run, against what a global step at the
+    // finest bin would have cost.
+    size_t total = 0;
+    vector<size_t> count(block_levels, 0);
+    for (size_t i = 0; i < npart; ++i) {
+      ++count[blocks.bin[i]];
+    }
+    for (int b = 0; b < block_levels; ++b) {
+      cout << "block_bin=" << b << " dt=" << delta_t/(1ul << b)
+      << " particles=" << count[b] << " particle_evals=" << blocks.evals[b]
+      << "\n";
+      total += blocks.evals[b];
+    }
+    cout << "particle_evals=" << total << " finest_global_step_evals="
+    << (double) npart*nsteps*(1ul << (block_levels - 1)) << "\n";
+  }
 
-  delete [] axvec;
-  delete [] ayvec;
-  delete [] azvec;
+  if (sfc_curve != SFC_NONE) {
+    cout << "sfc_reorders=" << sfc_reorders << " sfc_ms_per_reorder="
+    << sfc_time/(sfc_reorders > 0 ? sfc_reorders : 1) << "\n";
+  }
 
-  delete [] massvec;
+  if (respa_k > 0) {
+    cout << "respa_slow_evals=" << respa_slow_evals << " respa_fast_evals="
+    << respa_fast_evals << "\n";
+  }
 
-  return 0;
-}
+  if (force_mode == FORCE_VERLET) {
+    cout << "verlet_builds=" << verlet.builds << " neighbours_per_particle="
+    << (double) verlet.neigh.size()/npart << "\n";
+  }
 
-int write_all_particle_details_to_file(string filename)
-{
-  ofstream myfile;
+  if (tasks) {
+    ws_report(pool);
+  }
 
-  myfile.open(PDPATH + filename, ios::out);
-  if (myfile.is_open()) {
+  if (t_end > 0) {
+    cout << "steps=" << steps_taken << " sim_time=" << sim_time
+    << " min_dt=" << dt_min_used << " max_dt=" << dt_max_used << "\n";
+  }
 
-    myfile << "# vtk DataFile Version 1.0\n";
-    myfile << "3D position data\n";
+  if (energy_check && nheld == npart) {
+    double energy = total_energy();
+    cout << "energy_error=" << fabs((energy - energy0)/energy0)
+    << " force_evals=" << force_evals << "\n";
+  }
 
-    myfile << "ASCII\n\n";
+  if (force_check > 0 && force_mode != FORCE_DIRECT) {
+    cout << "force_error_vs_direct rms=" << force_err_rms
+    << " max=" << force_err_max << "\n";
+  }
 
-    myfile << "DATASET POLYDATA\n";
-    myfile << "POINTS " << npart << " float\n";
+  if (scaling > 0) {
+    report_scaling();
+  }
 
-    for (size_t i = 0; i < npart; ++i) {
-      // Write particle i's position to file.
-      myfile << pxvec[i] << " " << pyvec[i] << " " << pzvec[i] << "\n";
+#ifdef USE_MPI
+  if (force_mode == FORCE_RING) {
+    // Force loop and non-overlapped communication time of every rank, with
+    // the blocks it sent, the particle arrays and ring blocks it holds and
+    // its peak resident size.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    double held = (10.0*sizeof(float) + sizeof(size_t))*nheld
+      + (ring.block[0].capacity() + ring.block[1].capacity())*sizeof(float);
+    double stats[5] = {ring.compute_time, ring.comm_time,
+      (double) ring.messages, held, usage.ru_maxrss*1024.0};
+    vector<double> all(5*ring.nranks);
+    MPI_Gather(stats, 5, MPI_DOUBLE, &all[0], 5, MPI_DOUBLE, 0, ring.comm);
+    for (int r = 0; r < ring.nranks; ++r) {
+      size_t first, count;
+      ring_partition(npart, ring.nranks, r, &first, &count);
+      cout << "rank=" << r << " particles=" << count
+      << " compute_ms_per_step=" << all[5*r]*1e3/steps_taken
+      << " comm_ms_per_step=" << all[5*r + 1]*1e3/steps_taken
+      << " messages_per_step=" << all[5*r + 2]/steps_taken
+      << " particle_data_mb=" << all[5*r + 3]/(1 << 20)
+      << " max_rss_mb=" << all[5*r + 4]/(1 << 20) << "\n";
     }
 
-    myfile.close();
-  } else {
+    // The same totals over the ranks sharing rank 0's node, to compare
+    // hybrid runs against pure MPI ones with one rank per core.
+    MPI_Comm node;
+    MPI_Comm_split_type(ring.comm, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL,
+      &node);
+    int node_ranks;
+    MPI_Comm_size(node, &node_ranks);
+    double node_stats[3];
+    MPI_Reduce(stats + 2, node_stats, 3, MPI_DOUBLE, MPI_SUM, 0, node);
+    MPI_Comm_free(&node);
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+    cout << "node_ranks=" << node_ranks << " threads_per_rank=" << threads
+    << " messages_per_step=" << node_stats[0]/steps_taken
+    << " particle_data_mb_per_node=" << node_stats[1]/(1 << 20)
+    << " max_rss_mb_per_node=" << node_stats[2]/(1 << 20) << "\n";
+  }
+  if (force_mode == FORCE_ORB) {
+    // Tree and decomposition time of every rank.
+    double times[2] = {orb.force_time, orb.comm_time};
+    vector<double> all(2*orb.nranks);
+    MPI_Gather(times, 2, MPI_DOUBLE, &all[0], 2, MPI_DOUBLE, 0, orb.comm);
+    unsigned long counts[3] = {orb.id.size(), orb.let_items, orb.migrated};
+    vector<unsigned long> all_counts(3*orb.nranks);
+    MPI_Gather(counts, 3, MPI_UNSIGNED_LONG, &all_counts[0], 3,
+      MPI_UNSIGNED_LONG, 0, orb.comm);
+    for (int r = 0; r < orb.nranks; ++r) {
+      cout << "rank=" << r << " particles=" << all_counts[3*r]
+      << " let_items_per_step=" << (double) all_counts[3*r + 1]/steps_taken
+      << " migrated=" << all_counts[3*r + 2]
+      << " force_ms_per_step=" << all[2*r]*1e3/steps_taken
+      << " decomposition_ms_per_step=" << all[2*r + 1]*1e3/steps_taken
+      << "\n";
+    }
+
+    // Largest over mean work per step, the same on every rank.
+    cout << "orb_imbalance mean="
+    << orb.imbalance_sum/(orb.steps > 0 ? orb.steps : 1)
+    << " max=" << orb.imbalance_max << " last=" << orb.imbalance << "\n";
+    orb_free(orb);
+  }
+#endif
+
+  placement_free(pxvec, nheld);
+  placement_free(pyvec, nheld);
+  placement_free(pzvec, nheld);
+
+  placement_free(vxvec, nheld);
+  placement_free(vyvec, nheld);
+  placement_free(vzvec, nheld);
+
+  placement_free(axvec, nheld);
+  placement_free(ayvec, nheld);
+  placement_free(azvec, nheld);
+
+  placement_free(massvec, nheld);
+
+  delete [] idvec;
+
+  if (tasks) {
+    ws_free(pool);
+  }
+
+  delete [] fxvec;
+  delete [] fyvec;
+  delete [] fzvec;
+
+  delete [] sxvec;
+  delete [] syvec;
+  delete [] szvec;
+
+  delete [] pxdvec;
+  delete [] pydvec;
+  delete [] pzdvec;
+
+  delete [] vxdvec;
+  delete [] vydvec;
+  delete [] vzdvec;
+
+  delete [] axdvec;
+  delete [] aydvec;
+  delete [] azdvec;
+
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+#ifdef USE_MPI
+  // Threaded ring hops call MPI from one thread at a time, the master
+  // thread only with mpi_thread=funneled.
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &mpi_provided);
+  int status = simulate(argc, argv);
+  MPI_Finalize();
+  return status;
+#else
+  return simulate(argc, argv);
+#endif
+}
+
+int write_all_particle_details_to_file(string filename)
+{
+  // Particles are reordered in memory; the ids tell them apart.
+  if (!engine_write_vtk(state, PDPATH + filename, idvec)) {
     cerr << "Unable to open file: " << filename << "\n";
     return 0;
   }
@@ -162,28 +735,57 @@ int write_all_particle_details_to_file(string filename)
 int init_particles() {
   // TODO: add check for proper memory allocation.
 
-  // Allocate space for particle positions.
-  pxvec =  new float[npart];
-  pyvec =  new float[npart];
-  pzvec =  new float[npart];
+  // Under force=orb and force=ring each rank generates and keeps only its
+  // initial share; rank 0 keeps all particles only if energy_check needs
+  // them.
+  first_held = 0;
+  nheld = npart;
+#ifdef USE_MPI
+  if (force_mode == FORCE_ORB || force_mode == FORCE_RING) {
+    int rank, nranks;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+    if (rank != 0 || !energy_check) {
+      if (force_mode == FORCE_ORB) {
+        orb_share(npart, nranks, rank, &first_held, &nheld);
+      } else {
+        ring_partition(npart, nranks, rank, &first_held, &nheld);
+      }
+    }
+  }
+#endif
+
+  // Allocate space for particle positions. Positions and masses are read
+  // by every thread of the force loop and may be interleaved.
+  pxvec =  placement_alloc(nheld, numa_policy);
+  pyvec =  placement_alloc(nheld, numa_policy);
+  pzvec =  placement_alloc(nheld, numa_policy);
 
   // Allocate space for particle velocities.
-  vxvec =  new float[npart];
-  vyvec =  new float[npart];
-  vzvec =  new float[npart];
+  vxvec =  placement_alloc(nheld, PLACE_FIRST_TOUCH);
+  vyvec =  placement_alloc(nheld, PLACE_FIRST_TOUCH);
+  vzvec =  placement_alloc(nheld, PLACE_FIRST_TOUCH);
 
   // Allocate space for particle accelerations.
-  axvec =  new float[npart];
-  ayvec =  new float[npart];
-  azvec =  new float[npart];
+  axvec =  placement_alloc(nheld, PLACE_FIRST_TOUCH);
+  ayvec =  placement_alloc(nheld, PLACE_FIRST_TOUCH);
+  azvec =  placement_alloc(nheld, PLACE_FIRST_TOUCH);
 
   // Allocate space for particle masses.
-  massvec =  new float[npart];
+  massvec =  placement_alloc(nheld, numa_policy);
+
+  // Allocate space for particle ids.
+  idvec = new size_t[nheld];
 
-  // Create vector of random numbers.
+  // Create vector of random numbers. The draws of the particles before
+  // first_held are skipped, so every particle gets the same state whichever
+  // rank generates it.
   // REVIEW: Do fix this. This is only done for now since we can't use rand() call in OpenACC.
-  float * randnums = new float[npart*4];
-  for (size_t i = 0; i < npart; ++i) {
+  for (size_t i = 0; i < 4*first_held; ++i) {
+    randu();
+  }
+  float * randnums = new float[nheld*4];
+  for (size_t i = 0; i < nheld; ++i) {
     randnums[i*4] = randu()-0.5;
     randnums[i*4 + 1] = randu()-0.5;
     randnums[i*4 + 2] = randu()-0.5;
@@ -195,7 +797,11 @@ int init_particles() {
     vxvec[0:npart], vyvec[0:npart], vzvec[0:npart], \
     axvec[0:npart], ayvec[0:npart], azvec[0:npart], \
     massvec[0:npart], randnums[0:npart*4])
-    for(size_t i=0; i < npart; ++i) {
+    // First touch with the default static schedule of the compute loops, so
+    // each thread's particles live on its own node. A dynamic or guided
+    // schedule has no fixed owner per page, so static is used regardless.
+    #pragma omp parallel for schedule(static)
+    for(size_t i=0; i < nheld; ++i) {
       pxvec[i] = randnums[i*4];
       pyvec[i] = randnums[i*4 + 1];
       pzvec[i] = randnums[i*4 + 2];
@@ -221,67 +827,788 @@ int init_particles() {
       // Initialize particle mass for all particles.
       massvec[i] = randnums[i*4 + 3];;
       massvec[i] *= scale_mass;
+
+      idvec[i] = first_held + i;
+    }
+
+    float *pos[3] = {pxvec, pyvec, pzvec};
+    float *vel[3] = {vxvec, vyvec, vzvec};
+    float *acc[3] = {axvec, ayvec, azvec};
+    engine_attach(state, nheld, pos, vel, acc, massvec);
+
+    if (force_mode == FORCE_DIRECT_MIXED) {
+      pxdvec = new double[npart];
+      pydvec = new double[npart];
+      pzdvec = new double[npart];
+
+      vxdvec = new double[npart];
+      vydvec = new double[npart];
+      vzdvec = new double[npart];
+
+      axdvec = new double[npart];
+      aydvec = new double[npart];
+      azdvec = new double[npart];
+
+      for (size_t i = 0; i < npart; ++i) {
+        pxdvec[i] = pxvec[i];
+        pydvec[i] = pyvec[i];
+        pzdvec[i] = pzvec[i];
+
+        vxdvec[i] = vxvec[i];
+        vydvec[i] = vyvec[i];
+        vzdvec[i] = vzvec[i];
+      }
+    }
+
+    if (respa_k > 0) {
+      fxvec = new float[npart];
+      fyvec = new float[npart];
+      fzvec = new float[npart];
+
+      sxvec = new float[npart];
+      syvec = new float[npart];
+      szvec = new float[npart];
     }
 
     return 1;
   }
 
+  /*
+  * Compute the accelerations of all particles by summing over all pairs.
+  */
+  void compute_direct_accelerations() {
+    switch (softening) {
+      case SOFT_PLUMMER:
+        engine_accelerations<3, soft_plummer>(state, G, eps);
+        break;
+      case SOFT_SPLINE:
+        engine_accelerations<3, soft_spline>(state, G, eps);
+        break;
+      case SOFT_NONE:
+        engine_accelerations<3, soft_none>(state, G, eps);
+        break;
+      default:
+        engine_accelerations<3>(state, G, eps);
+    }
+  }
+
+  /*
+  * Compute the accelerations of all particles with the selected force mode.
+  */
+  void compute_accelerations() {
+    ++force_evals;
+
+#ifdef USE_MPI
+    if (force_mode == FORCE_RING) {
+      ring_accelerations(ring, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps);
+      return;
+    }
+#endif
+
+    if (force_mode == FORCE_BH) {
+      bh_build(tree, npart, pxvec, pyvec, pzvec, massvec, BH_LEAF_SIZE, tasks);
+      bh_accelerations(tree, npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, theta, NULL, tasks);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_FMM) {
+      fmm_accelerations(npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, theta, fmm_order);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_PM) {
+      pm_accelerations(npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, size_x, size_y, size_z,
+        mesh_x, mesh_y, mesh_z, assign);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_TREEPM || force_mode == FORCE_P3M) {
+      // Long-range part on the mesh, short-range part from the tree.
+      float rs = pm_accelerations(npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, size_x, size_y, size_z,
+        mesh_x, mesh_y, mesh_z, assign, asmth);
+      bh_build(tree, npart, pxvec, pyvec, pzvec, massvec, BH_LEAF_SIZE, tasks);
+      treepm_short_range(tree, npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, force_mode == FORCE_P3M ? 0 : theta,
+        rs, treepm_rcut*rs);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_DIRECT_SYM) {
+      direct_symmetric_accelerations(npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, DIRECT_SYM_TILE);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_DIRECT_BLOCKED) {
+      direct_blocked_accelerations(npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, tile_i, tile_j, softening);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_DIRECT_SIMD) {
+      direct_simd_accelerations(npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, simd_isa, simd_nr);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_DIRECT_MIXED) {
+      direct_mixed_accelerations(npart, pxdvec, pydvec, pzdvec, massvec,
+        axdvec, aydvec, azdvec, G, eps, DIRECT_MIXED_TILE);
+      for (size_t i = 0; i < npart; ++i) {
+        axvec[i] = axdvec[i];
+        ayvec[i] = aydvec[i];
+        azvec[i] = azdvec[i];
+      }
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_CUTOFF) {
+      cell_list_build(cells, npart, pxvec, pyvec, pzvec, rcut);
+      cutoff_accelerations(cells, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, rcut, tasks, softening);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else if (force_mode == FORCE_VERLET) {
+      // Rebuild only once a particle may have crossed the skin.
+      if (verlet.builds == 0 || verlet_stale || verlet_moved > 0.5f*skin) {
+        cell_list_build(cells, npart, pxvec, pyvec, pzvec, rcut + skin);
+        verlet_build(verlet, cells, npart, pxvec, pyvec, pzvec, rcut + skin,
+          tasks);
+        verlet_moved = 0;
+        verlet_stale = false;
+      }
+      verlet_accelerations(verlet, npart, pxvec, pyvec, pzvec, massvec,
+        axvec, ayvec, azvec, G, eps, rcut, tasks, softening);
+      #pragma acc update device(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    } else {
+      compute_direct_accelerations();
+    }
+
+    if (force_check > 0 && force_mode != FORCE_DIRECT) {
+      check_force_error();
+    }
+  }
+
+  /*
+  * Double precision direct-sum acceleration of particle i with softening
+  * kernel K, from the double state when mixed is set.
+  */
+  template <class K>
+  static void reference_acceleration(size_t i, bool mixed,
+    double *ax, double *ay, double *az) {
+    *ax = *ay = *az = 0;
+    for (size_t j = 0; j < npart; ++j) {
+      if (i != j) {
+        double dx = mixed ? pxdvec[j]-pxdvec[i] : (double) pxvec[j]-pxvec[i];
+        double dy = mixed ? pydvec[j]-pydvec[i] : (double) pyvec[j]-pyvec[i];
+        double dz = mixed ? pzdvec[j]-pzdvec[i] : (double) pzvec[j]-pzvec[i];
+        double s = G*massvec[j]*K::factor(dx*dx+dy*dy+dz*dz, (double) eps);
+        *ax += s*dx;
+        *ay += s*dy;
+        *az += s*dz;
+      }
+    }
+  }
+
+  /*
+  * Compare the accelerations of force_check evenly spaced particles against
+  * the direct sum and keep track of the largest relative errors seen.
+  */
+  void check_force_error() {
+    size_t nsample = force_check < npart ? force_check : npart;
+    bool mixed = force_mode == FORCE_DIRECT_MIXED;
+    double sum_err2 = 0;
+    for (size_t k = 0; k < nsample; ++k) {
+      size_t i = k*npart/nsample;
+      double ax, ay, az;
+      switch (softening) {
+        case SOFT_PLUMMER:
+          reference_acceleration<soft_plummer>(i, mixed, &ax, &ay, &az);
+          break;
+        case SOFT_SPLINE:
+          reference_acceleration<soft_spline>(i, mixed, &ax, &ay, &az);
+          break;
+        case SOFT_NONE:
+          reference_acceleration<soft_none>(i, mixed, &ax, &ay, &az);
+          break;
+        default:
+          reference_acceleration<soft_legacy>(i, mixed, &ax, &ay, &az);
+      }
+
+      double ex = (mixed ? axdvec[i] : axvec[i])-ax;
+      double ey = (mixed ? aydvec[i] : ayvec[i])-ay;
+      double ez = (mixed ? azdvec[i] : azvec[i])-az;
+      double a2 = ax*ax+ay*ay+az*az;
+      double err2 = a2 > 0 ? (ex*ex+ey*ey+ez*ez)/a2 : 0;
+
+      sum_err2 += err2;
+      if (sqrt(err2) > force_err_max) {
+        force_err_max = sqrt(err2);
+      }
+    }
+
+    double rms = sqrt(sum_err2/nsample);
+    if (rms > force_err_rms) {
+      force_err_rms = rms;
+    }
+  }
+
   void update_particle_details() {
-    #pragma acc parallel loop present(pxvec,pyvec,pzvec,vxvec,vyvec,vzvec,axvec,ayvec,azvec,massvec)
-    for(size_t i = 0; i < npart; ++i) {
-      float xi = pxvec[i];
-      float yi = pyvec[i];
-      float zi = pzvec[i];
+#ifdef USE_MPI
+    if (force_mode == FORCE_ORB) {
+      orb_step(orb, G, eps, theta, delta_t);
+      ++force_evals;
+      return;
+    }
+#endif
+
+    if (block_levels > 1) {
+      force_evals += block_step(blocks, npart, pxvec, pyvec, pzvec,
+        vxvec, vyvec, vzvec, axvec, ayvec, azvec, massvec, G, eps, delta_t,
+        block_eta);
+      #pragma acc update device(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart], \
+        vxvec[0:npart], vyvec[0:npart], vzvec[0:npart], \
+        axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+      return;
+    }
 
-      float mi = massvec[i];
+    if (respa_k > 0) {
+      respa_step();
+      return;
+    }
 
-      axvec[i] = 0.0;
-      ayvec[i] = 0.0;
-      azvec[i] = 0.0;
+    if (integrator == INTEGRATOR_HERMITE) {
+      force_evals += hermite_step(hermite, npart, pxvec, pyvec, pzvec,
+        vxvec, vyvec, vzvec, axvec, ayvec, azvec, massvec, G, eps, delta_t);
+      #pragma acc update device(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart], \
+        vxvec[0:npart], vyvec[0:npart], vzvec[0:npart], \
+        axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+      return;
+    }
+
+    if (integrator != INTEGRATOR_EULER) {
+      symplectic_step();
+      return;
+    }
+
+    compute_accelerations();
+    choose_step();
+
+#ifdef USE_MPI
+    if (force_mode == FORCE_RING) {
+      // Each rank advances only its own particles, which come first in
+      // its arrays; ring_gather() collects them at the end of the run.
+      #pragma omp parallel for schedule(runtime)
+      for (size_t i = 0; i < ring.count; ++i) {
+        vxvec[i] += axvec[i]*delta_t;
+        vyvec[i] += ayvec[i]*delta_t;
+        vzvec[i] += azvec[i]*delta_t;
+
+        pxvec[i] += vxvec[i]*delta_t;
+        pyvec[i] += vyvec[i]*delta_t;
+        pzvec[i] += vzvec[i]*delta_t;
+      }
+      return;
+    }
+#endif
+
+    if (force_mode == FORCE_DIRECT_MIXED) {
+      // Integrate the double precision state and refresh the float copies.
+      #pragma omp parallel for schedule(runtime)
+      for (size_t i = 0; i < npart; ++i) {
+        vxdvec[i] += axdvec[i]*delta_t;
+        vydvec[i] += aydvec[i]*delta_t;
+        vzdvec[i] += azdvec[i]*delta_t;
+
+        pxdvec[i] += vxdvec[i]*delta_t;
+        pydvec[i] += vydvec[i]*delta_t;
+        pzdvec[i] += vzdvec[i]*delta_t;
+
+        vxvec[i] = vxdvec[i];
+        vyvec[i] = vydvec[i];
+        vzvec[i] = vzdvec[i];
+
+        pxvec[i] = pxdvec[i];
+        pyvec[i] = pydvec[i];
+        pzvec[i] = pzdvec[i];
+      }
+      return;
+    }
 
-      for(size_t j = 0; j < npart; ++j) {
-        if (i != j) {
-          float xj = pxvec[j];
-          float yj = pyvec[j];
-          float zj = pzvec[j];
+    if (force_mode == FORCE_VERLET) {
+      // Same update on the host, also accumulating how far each particle
+      // has moved since its neighbour list was built.
+      float *disp_x = &verlet.disp_x[0];
+      float *disp_y = &verlet.disp_y[0];
+      float *disp_z = &verlet.disp_z[0];
+      float max_disp2 = 0;
+
+      #pragma omp parallel for schedule(runtime) reduction(max:max_disp2)
+      for (size_t i = 0; i < npart; ++i) {
+        vxvec[i] += axvec[i]*delta_t;
+        vyvec[i] += ayvec[i]*delta_t;
+        vzvec[i] += azvec[i]*delta_t;
+
+        float sx = vxvec[i]*delta_t;
+        float sy = vyvec[i]*delta_t;
+        float sz = vzvec[i]*delta_t;
+
+        pxvec[i] += sx;
+        pyvec[i] += sy;
+        pzvec[i] += sz;
+
+        disp_x[i] += sx;
+        disp_y[i] += sy;
+        disp_z[i] += sz;
+
+        float disp2 = disp_x[i]*disp_x[i] + disp_y[i]*disp_y[i]
+          + disp_z[i]*disp_z[i];
+        if (disp2 > max_disp2) {
+          max_disp2 = disp2;
+        }
+      }
 
-          float mj = massvec[j];
+      verlet_moved = sqrt(max_disp2);
+      #pragma acc update device(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart], \
+        vxvec[0:npart], vyvec[0:npart], vzvec[0:npart])
+      return;
+    }
 
-          float dx = xj-xi;
-          float dy = yj-yi;
-          float dz = zj-zi;
+    engine_integrate(state, delta_t);
 
-          float d = sqrt(dx*dx+dy*dy+dz*dz)+eps;
+    #pragma acc update host(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart])
+  }
 
-          float f = G*mi*mj/(d*d);
-          float fx = f*(dx/d);
-          float fy = f*(dy/d);
-          float fz = f*(dz/d);
+  /*
+  * Fast near-field accelerations, from the cell lists truncated at rcut.
+  */
+  static void compute_fast_accelerations() {
+    cell_list_build(cells, npart, pxvec, pyvec, pzvec, rcut);
+    cutoff_accelerations(cells, pxvec, pyvec, pzvec, massvec,
+      fxvec, fyvec, fzvec, G, eps, rcut, tasks, softening);
+    ++respa_fast_evals;
+  }
 
-          // #pragma acc atomic
-          axvec[i] += fx/mi;
-          // #pragma acc atomic
-          ayvec[i] += fy/mi;
-          // #pragma acc atomic
-          azvec[i] += fz/mi;
+  /*
+  * Slow accelerations: the total from the selected force mode minus the
+  * fast part, which must be current.
+  */
+  static void compute_slow_accelerations() {
+    compute_accelerations();
+    #pragma acc update host(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    #pragma omp parallel for schedule(runtime)
+    for (size_t i = 0; i < npart; ++i) {
+      sxvec[i] = axvec[i] - fxvec[i];
+      syvec[i] = ayvec[i] - fyvec[i];
+      szvec[i] = azvec[i] - fzvec[i];
+    }
+    ++respa_slow_evals;
+  }
+
+  /*
+  * Kick the velocities by h times the given accelerations.
+  */
+  static void kick(const float *ax, const float *ay, const float *az, float h) {
+    #pragma omp parallel for schedule(runtime)
+    for (size_t i = 0; i < npart; ++i) {
+      vxvec[i] += ax[i]*h;
+      vyvec[i] += ay[i]*h;
+      vzvec[i] += az[i]*h;
+    }
+  }
+
+  /*
+  * Move the particles along their velocities for h, tracking displacements
+  * for the Verlet lists as the Euler update does.
+  */
+  static void drift(float h) {
+    float max_disp2 = 0;
+    #pragma omp parallel for schedule(runtime) reduction(max:max_disp2)
+    for (size_t i = 0; i < npart; ++i) {
+      pxvec[i] += vxvec[i]*h;
+      pyvec[i] += vyvec[i]*h;
+      pzvec[i] += vzvec[i]*h;
+
+      if (force_mode == FORCE_VERLET && verlet.builds > 0) {
+        verlet.disp_x[i] += vxvec[i]*h;
+        verlet.disp_y[i] += vyvec[i]*h;
+        verlet.disp_z[i] += vzvec[i]*h;
+
+        float disp2 = verlet.disp_x[i]*verlet.disp_x[i]
+          + verlet.disp_y[i]*verlet.disp_y[i]
+          + verlet.disp_z[i]*verlet.disp_z[i];
+        if (disp2 > max_disp2) {
+          max_disp2 = disp2;
         }
       }
     }
 
-    #pragma acc parallel loop present(pxvec,pyvec,pzvec,vxvec,vyvec,vzvec,axvec,ayvec,azvec,massvec)
+    if (force_mode == FORCE_VERLET) {
+      verlet_moved = sqrt(max_disp2);
+    }
+    #pragma acc update device(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart])
+  }
+
+  /*
+  * One kick-drift-kick leapfrog step of h, reusing the accelerations left
+  * by the previous step.
+  */
+  static void leapfrog(float h) {
+    kick(axvec, ayvec, azvec, 0.5f*h);
+    drift(h);
+    compute_accelerations();
+    #pragma acc update host(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    kick(axvec, ayvec, azvec, 0.5f*h);
+  }
+
+  /*
+  * One step of delta_t with the selected symplectic integrator: a single
+  * leapfrog step, or Yoshida's fourth-order composition of three leapfrog
+  * steps of w1, w0 and w1 times delta_t (Forest & Ruth 1990, Yoshida 1990),
+  * at three force evaluations per step.
+  */
+  void symplectic_step() {
+    if (!have_acc) {
+      compute_accelerations();
+      #pragma acc update host(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+      have_acc = true;
+    }
+    choose_step();
+
+    if (integrator == INTEGRATOR_KDK) {
+      leapfrog(delta_t);
+    } else {
+      double cbrt2 = cbrt(2.0);
+      float w1 = 1.0/(2.0 - cbrt2);
+      float w0 = -cbrt2/(2.0 - cbrt2);
+      leapfrog(w1*delta_t);
+      leapfrog(w0*delta_t);
+      leapfrog(w1*delta_t);
+    }
+
+    #pragma acc update device(vxvec[0:npart], vyvec[0:npart], vzvec[0:npart])
+  }
+
+  /*
+  * In adaptive mode (dt_eta > 0), set delta_t for the next step from the
+  * current accelerations and velocities: dt_eta times the smaller of
+  * sqrt(eps/|a|) and eps/|v| over all particles, at most the delta_t given
+  * on the command line and ending exactly at t_end.
+  */
+  void choose_step() {
+    if (dt_eta <= 0) {
+      return;
+    }
+
+    float amax2 = 0, vmax2 = 0;
+    #pragma acc update host(axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    #pragma omp parallel for schedule(runtime) reduction(max:amax2,vmax2)
     for (size_t i = 0; i < npart; ++i) {
-      // Update particle velocities.
-      vxvec[i] += axvec[i]*delta_t;
-      vyvec[i] += ayvec[i]*delta_t;
-      vzvec[i] += azvec[i]*delta_t;
+      float a2 = axvec[i]*axvec[i] + ayvec[i]*ayvec[i] + azvec[i]*azvec[i];
+      float v2 = vxvec[i]*vxvec[i] + vyvec[i]*vyvec[i] + vzvec[i]*vzvec[i];
+      amax2 = a2 > amax2 ? a2 : amax2;
+      vmax2 = v2 > vmax2 ? v2 : vmax2;
+    }
+
+    float dt = dt_max;
+    if (amax2 > 0) {
+      dt = fminf(dt, dt_eta*sqrt(eps/sqrt(amax2)));
+    }
+    if (vmax2 > 0) {
+      dt = fminf(dt, dt_eta*eps/sqrt(vmax2));
+    }
+    final_step = sim_time + dt >= t_end*(1 - T_END_TOL);
+    if (final_step) {
+      dt = t_end - sim_time;
+    }
+    delta_t = dt;
+  }
 
-      // Update particle positions.
-      pxvec[i] += vxvec[i]*delta_t;
-      pyvec[i] += vyvec[i]*delta_t;
-      pzvec[i] += vzvec[i]*delta_t;
+  /*
+  * Set up the OpenMP team: thread count, schedule and pinning, and the
+  * work-stealing pool with one worker per thread.
+  * @return 1 on success, 0 on error.*/
+  int init_threads() {
+    if (!set_schedule(schedule_name)) {
+      cerr << "Invalid schedule: " << schedule_name << "\n";
+      return 0;
+    }
+#ifdef _OPENMP
+    if (nthreads > 0) {
+      omp_set_num_threads(nthreads);
+    }
+#else
+    if (nthreads > 1 || scaling > 0) {
+      cerr << "threads and scaling require an OpenMP build (particles_omp)\n";
+      return 0;
     }
+#endif
+    if (!placement_pin_threads(affinity)) {
+      cerr << "affinity requires an OpenMP build with NUMA support "
+      << "(particles_numa)\n";
+      return 0;
+    }
+#ifndef USE_NUMA
+    if (numa_policy != PLACE_FIRST_TOUCH) {
+      cerr << "numa=interleave requires a build with NUMA support "
+      << "(particles_numa)\n";
+      return 0;
+    }
+#endif
+    if (steal) {
+#ifdef _OPENMP
+      ws_init(pool, omp_get_max_threads());
+#else
+      ws_init(pool, 1);
+#endif
+      tasks = &pool;
+    }
+    return 1;
+  }
 
-    #pragma acc update host(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart])
+  /*
+  * Set the OpenMP schedule of the schedule(runtime) loops.
+  * @param name static, dynamic or guided, optionally followed by ",chunk".
+  * @return 1 on success, 0 on error.*/
+  int set_schedule(const char *name) {
+    char kind[16] = "";
+    int chunk = 0;
+    if (sscanf(name, "%15[a-z],%d", kind, &chunk) < 1 || chunk < 0) {
+      return 0;
+    }
+#ifdef _OPENMP
+    omp_sched_t sched;
+    if (!strcmp(kind, "static"))
+    sched = omp_sched_static;
+    else if (!strcmp(kind, "dynamic"))
+    sched = omp_sched_dynamic;
+    else if (!strcmp(kind, "guided"))
+    sched = omp_sched_guided;
+    else
+    return 0;
+    omp_set_schedule(sched, chunk);
+    return 1;
+#else
+    return !strcmp(kind, "static") || !strcmp(kind, "dynamic")
+      || !strcmp(kind, "guided");
+#endif
+  }
+
+  /*
+  * Time scaling more steps at 1, 2, 4, ... threads up to the thread count
+  * of the run and report the time per step, speedup and parallel
+  * efficiency against one thread. This continues the simulation from its
+  * final state.
+  */
+  void report_scaling() {
+#ifdef _OPENMP
+    int max_threads = omp_get_max_threads();
+    double base = 0;
+    for (int t = 1; ; t = t*2 < max_threads ? t*2 : max_threads) {
+      omp_set_num_threads(t);
+      high_resolution_clock::time_point t1 = high_resolution_clock::now();
+      for (size_t i = 0; i < scaling; ++i) {
+        update_particle_details();
+      }
+      high_resolution_clock::time_point t2 = high_resolution_clock::now();
+      double ms = duration_cast<microseconds>(t2 - t1).count()*1e-3/scaling;
+      base = t == 1 ? ms : base;
+
+      cout << "scaling threads=" << t << " ms_per_step=" << ms
+      << " speedup=" << base/ms << " efficiency=" << base/ms/t << "\n";
+      if (t == max_threads) {
+        break;
+      }
+    }
+    omp_set_num_threads(max_threads);
+#endif
+  }
+
+  /*
+  * Sort the particles along the space-filling curve, permuting every
+  * per-particle array in place, including the state kept between steps by
+  * the selected integrator and force mode.
+  */
+  void reorder_particles() {
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    #pragma acc update host(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart], \
+      vxvec[0:npart], vyvec[0:npart], vzvec[0:npart], \
+      axvec[0:npart], ayvec[0:npart], azvec[0:npart])
+    sfc_order(sfc, npart, pxvec, pyvec, pzvec, sfc_curve);
+
+    float *arrays[10] = {pxvec, pyvec, pzvec, vxvec, vyvec, vzvec,
+      axvec, ayvec, azvec, massvec};
+    for (int k = 0; k < 10; ++k) {
+      sfc_permute(sfc, npart, arrays[k]);
+    }
+    sfc_permute(sfc, npart, idvec);
+
+    if (force_mode == FORCE_DIRECT_MIXED) {
+      double *state[9] = {pxdvec, pydvec, pzdvec, vxdvec, vydvec, vzdvec,
+        axdvec, aydvec, azdvec};
+      for (int k = 0; k < 9; ++k) {
+        sfc_permute(sfc, npart, state[k]);
+      }
+    }
+    if (respa_k > 0) {
+      float *parts[6] = {fxvec, fyvec, fzvec, sxvec, syvec, szvec};
+      for (int k = 0; k < 6; ++k) {
+        sfc_permute(sfc, npart, parts[k]);
+      }
+    }
+    if (integrator == INTEGRATOR_HERMITE) {
+      sfc_permute(sfc, npart, &hermite.jx[0]);
+      sfc_permute(sfc, npart, &hermite.jy[0]);
+      sfc_permute(sfc, npart, &hermite.jz[0]);
+    }
+    if (block_levels > 1) {
+      sfc_permute(sfc, npart, &blocks.bin[0]);
+    }
+    if (force_mode == FORCE_VERLET && verlet.builds > 0) {
+      // The lists hold old indices; force a rebuild. The drift of the
+      // kdk, yoshida and RESPA steps rewrites verlet_moved before the next
+      // force pass, so the flag is kept apart from it.
+      sfc_permute(sfc, npart, &verlet.disp_x[0]);
+      sfc_permute(sfc, npart, &verlet.disp_y[0]);
+      sfc_permute(sfc, npart, &verlet.disp_z[0]);
+      verlet_stale = true;
+    }
+
+    #pragma acc update device(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart], \
+      vxvec[0:npart], vyvec[0:npart], vzvec[0:npart], \
+      axvec[0:npart], ayvec[0:npart], azvec[0:npart], massvec[0:npart])
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    sfc_time += duration_cast<microseconds>(t2 - t1).count()*1e-3;
+    ++sfc_reorders;
+  }
+
+  /*
+  * Run all nsteps steps with Parareal and report its statistics.
+  * @return The wall time, in ms.*/
+  double run_parareal() {
+    parareal_params params;
+    params.nsteps = nsteps;
+    params.dt = delta_t;
+    params.nslices = parareal_slices;
+    params.coarse_steps = parareal_coarse;
+    params.theta = parareal_theta;
+    params.tol = parareal_tol;
+    params.max_iter = parareal_slices;
+    params.nthreads = parareal_threads > 0 ? parareal_threads
+      : std::thread::hardware_concurrency();
+    params.nthreads = params.nthreads > 0 ? params.nthreads : 1;
+
+    // Initial state for the serial reference.
+    vector<float> ref[6];
+    float *state[6] = {pxvec, pyvec, pzvec, vxvec, vyvec, vzvec};
+    if (parareal_check) {
+      for (int k = 0; k < 6; ++k) {
+        ref[k].assign(state[k], state[k] + npart);
+      }
+    }
+
+    parareal_stats stats;
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    parareal_run(params, npart, pxvec, pyvec, pzvec, vxvec, vyvec, vzvec,
+      massvec, G, eps, &stats);
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+    double wall = duration_cast<microseconds>(t2 - t1).count()*1e-3;
+    #pragma acc update device(pxvec[0:npart], pyvec[0:npart], pzvec[0:npart], \
+      vxvec[0:npart], vyvec[0:npart], vzvec[0:npart])
+
+    cout << "parareal_iterations=" << stats.iterations
+    << " correction=" << stats.correction
+    << " threads=" << params.nthreads
+    << " wall_ms=" << wall
+    << " fine_ms=" << stats.fine_time*1e3
+    << " coarse_ms=" << stats.coarse_time*1e3 << "\n";
+
+    if (parareal_check) {
+      t1 = high_resolution_clock::now();
+      parareal_serial(params, npart, &ref[0][0], &ref[1][0], &ref[2][0],
+        &ref[3][0], &ref[4][0], &ref[5][0], massvec, G, eps);
+      t2 = high_resolution_clock::now();
+      double serial = duration_cast<microseconds>(t2 - t1).count()*1e-3;
+
+      double diff = 0;
+      for (int k = 0; k < 3; ++k) {
+        for (size_t i = 0; i < npart; ++i) {
+          diff = fmax(diff, fabs(ref[k][i] - state[k][i]));
+        }
+      }
+      cout << "parareal_vs_serial max_position_diff=" << diff
+      << " serial_ms=" << serial << " speedup=" << serial/wall << "\n";
+    }
+
+    return wall/nsteps;
+  }
+
+  /*
+  * Potential energy of particle i with the particles after it, in double
+  * precision, for softening kernel K.
+  */
+  template <class K>
+  static double pair_potential(size_t i) {
+    double potential = 0;
+    for (size_t j = i + 1; j < npart; ++j) {
+      double dx = (double) pxvec[j] - pxvec[i];
+      double dy = (double) pyvec[j] - pyvec[i];
+      double dz = (double) pzvec[j] - pzvec[i];
+      potential += (double) G*massvec[i]*massvec[j]
+        *K::potential(dx*dx + dy*dy + dz*dz, (double) eps);
+    }
+    return potential;
+  }
+
+  /*
+  * Kinetic plus potential energy, in double precision, with the pair
+  * potential of the selected softening kernel. For the legacy force law
+  * G*m_i*m_j*r/(r + eps)^3 it is -G*m_i*m_j*(2r + eps)/(2(r + eps)^2).
+  */
+  double total_energy() {
+    double kinetic = 0, potential = 0;
+
+    #pragma omp parallel for schedule(dynamic, 16) reduction(+:kinetic,potential)
+    for (size_t i = 0; i < npart; ++i) {
+      double v2 = (double) vxvec[i]*vxvec[i] + (double) vyvec[i]*vyvec[i]
+        + (double) vzvec[i]*vzvec[i];
+      kinetic += 0.5*massvec[i]*v2;
+
+      switch (softening) {
+        case SOFT_PLUMMER:
+          potential += pair_potential<soft_plummer>(i);
+          break;
+        case SOFT_SPLINE:
+          potential += pair_potential<soft_spline>(i);
+          break;
+        case SOFT_NONE:
+          potential += pair_potential<soft_none>(i);
+          break;
+        default:
+          potential += pair_potential<soft_legacy>(i);
+      }
+    }
+
+    return kinetic + potential;
+  }
+
+  /*
+  * One fast sub-step of delta_t of the impulse (RESPA) integrator. A slow
+  * step spans respa_k sub-steps and is bracketed by two half kicks of the
+  * slow force; in between, the fast force drives ordinary kick-drift-kick
+  * steps. The slow force is thus evaluated once per respa_k sub-steps.
+  */
+  void respa_step() {
+    float slow_h = 0.5f*respa_k*delta_t;
+
+    if (respa_slow_evals == 0) {
+      compute_fast_accelerations();
+      compute_slow_accelerations();
+    }
+    if (respa_sub == 0) {
+      kick(sxvec, syvec, szvec, slow_h);
+    }
+
+    kick(fxvec, fyvec, fzvec, 0.5f*delta_t);
+    drift(delta_t);
+    compute_fast_accelerations();
+    kick(fxvec, fyvec, fzvec, 0.5f*delta_t);
+
+    if (++respa_sub == respa_k) {
+      compute_slow_accelerations();
+      kick(sxvec, syvec, szvec, slow_h);
+      respa_sub = 0;
+    }
+
+    #pragma acc update device(vxvec[0:npart], vyvec[0:npart], vzvec[0:npart])
   }
 
   /* Initialize default parameters.
@@ -305,12 +1632,28 @@ int init_particles() {
     printf("npart=%lu\n", npart);
     printf("delta_t=%f\n", delta_t);
     printf("nsteps=%lu\n", nsteps);
+    printf("force=%d\n", force_mode);
+    printf("theta=%f\n", theta);
+    printf("fmm_order=%d\n", fmm_order);
+    printf("mesh=%dx%dx%d\n", mesh_x, mesh_y, mesh_z);
+    printf("rcut=%f\n", rcut);
+    printf("skin=%f\n", skin);
     #endif
 
     return 1;
   }
 
 
+  /*
+  * Check that n can be used as a PM mesh size (a power of two, at least 8).
+  * @return 1 if it can, 0 otherwise.*/
+  static int
+  is_mesh_size(int n)
+  {
+    return n >= 8 && (n & (n - 1)) == 0;
+  }
+
+
   /*
   * Process the given command-line parameter.
   * @param arg The command-line parameter.
@@ -333,9 +1676,227 @@ int init_particles() {
     else if (strstr(arg, "delta_t="))
     return sscanf(arg, "delta_t=%f", &delta_t) == 1;
 
+    else if (strstr(arg, "integrator=")) {
+      if (!strcmp(arg, "integrator=euler"))
+      integrator = INTEGRATOR_EULER;
+      else if (!strcmp(arg, "integrator=kdk"))
+      integrator = INTEGRATOR_KDK;
+      else if (!strcmp(arg, "integrator=yoshida"))
+      integrator = INTEGRATOR_YOSHIDA;
+      else if (!strcmp(arg, "integrator=hermite"))
+      integrator = INTEGRATOR_HERMITE;
+      else
+      return 0;
+      return 1;
+    }
+
     else if (strstr(arg, "nsteps="))
     return sscanf(arg, "nsteps=%zu", &nsteps) == 1;
 
+    else if (strstr(arg, "force=")) {
+      if (!strcmp(arg, "force=direct"))
+      force_mode = FORCE_DIRECT;
+      else if (!strcmp(arg, "force=direct_sym"))
+      force_mode = FORCE_DIRECT_SYM;
+      else if (!strcmp(arg, "force=direct_blocked"))
+      force_mode = FORCE_DIRECT_BLOCKED;
+      else if (!strcmp(arg, "force=direct_simd"))
+      force_mode = FORCE_DIRECT_SIMD;
+      else if (!strcmp(arg, "force=direct_mixed"))
+      force_mode = FORCE_DIRECT_MIXED;
+      else if (!strcmp(arg, "force=bh"))
+      force_mode = FORCE_BH;
+      else if (!strcmp(arg, "force=fmm"))
+      force_mode = FORCE_FMM;
+      else if (!strcmp(arg, "force=pm"))
+      force_mode = FORCE_PM;
+      else if (!strcmp(arg, "force=treepm"))
+      force_mode = FORCE_TREEPM;
+      else if (!strcmp(arg, "force=p3m"))
+      force_mode = FORCE_P3M;
+      else if (!strcmp(arg, "force=cutoff"))
+      force_mode = FORCE_CUTOFF;
+      else if (!strcmp(arg, "force=verlet"))
+      force_mode = FORCE_VERLET;
+#ifdef USE_MPI
+      else if (!strcmp(arg, "force=ring"))
+      force_mode = FORCE_RING;
+      else if (!strcmp(arg, "force=orb"))
+      force_mode = FORCE_ORB;
+#endif
+      else
+      return 0;
+      return 1;
+    }
+
+#ifdef USE_MPI
+    else if (strstr(arg, "mpi_thread=")) {
+      if (!strcmp(arg, "mpi_thread=funneled"))
+      mpi_thread = RING_FUNNELED;
+      else if (!strcmp(arg, "mpi_thread=serialized"))
+      mpi_thread = RING_SERIALIZED;
+      else
+      return 0;
+      return 1;
+    }
+#endif
+
+    else if (strstr(arg, "parareal="))
+    return sscanf(arg, "parareal=%zu", &parareal_slices) == 1;
+
+    else if (strstr(arg, "parareal_coarse="))
+    return sscanf(arg, "parareal_coarse=%zu", &parareal_coarse) == 1
+    && parareal_coarse > 0;
+
+    else if (strstr(arg, "parareal_theta="))
+    return sscanf(arg, "parareal_theta=%f", &parareal_theta) == 1
+    && parareal_theta >= 0;
+
+    else if (strstr(arg, "parareal_tol="))
+    return sscanf(arg, "parareal_tol=%f", &parareal_tol) == 1;
+
+    else if (strstr(arg, "parareal_threads="))
+    return sscanf(arg, "parareal_threads=%zu", &parareal_threads) == 1;
+
+    else if (strstr(arg, "parareal_check="))
+    return sscanf(arg, "parareal_check=%d", &parareal_check) == 1;
+
+    else if (strstr(arg, "threads="))
+    return sscanf(arg, "threads=%d", &nthreads) == 1 && nthreads > 0;
+
+    else if (strstr(arg, "schedule="))
+    return sscanf(arg, "schedule=%31s", schedule_name) == 1;
+
+    else if (strstr(arg, "numa=")) {
+      if (!strcmp(arg, "numa=first_touch"))
+      numa_policy = PLACE_FIRST_TOUCH;
+      else if (!strcmp(arg, "numa=interleave"))
+      numa_policy = PLACE_INTERLEAVE;
+      else
+      return 0;
+      return 1;
+    }
+
+    else if (strstr(arg, "affinity=")) {
+      if (!strcmp(arg, "affinity=none"))
+      affinity = AFFINITY_NONE;
+      else if (!strcmp(arg, "affinity=compact"))
+      affinity = AFFINITY_COMPACT;
+      else if (!strcmp(arg, "affinity=scatter"))
+      affinity = AFFINITY_SCATTER;
+      else
+      return 0;
+      return 1;
+    }
+
+    else if (strstr(arg, "sfc=")) {
+      if (!strcmp(arg, "sfc=none"))
+      sfc_curve = SFC_NONE;
+      else if (!strcmp(arg, "sfc=morton"))
+      sfc_curve = SFC_MORTON;
+      else if (!strcmp(arg, "sfc=hilbert"))
+      sfc_curve = SFC_HILBERT;
+      else
+      return 0;
+      return 1;
+    }
+
+    else if (strstr(arg, "sfc_every="))
+    return sscanf(arg, "sfc_every=%zu", &sfc_every) == 1 && sfc_every > 0;
+
+    else if (strstr(arg, "steal="))
+    return sscanf(arg, "steal=%d", &steal) == 1;
+
+    else if (strstr(arg, "scaling="))
+    return sscanf(arg, "scaling=%zu", &scaling) == 1;
+
+    else if (strstr(arg, "theta="))
+    return sscanf(arg, "theta=%f", &theta) == 1 && theta > 0;
+
+    else if (strstr(arg, "fmm_order="))
+    return sscanf(arg, "fmm_order=%d", &fmm_order) == 1
+    && fmm_order >= FMM_MIN_ORDER && fmm_order <= FMM_MAX_ORDER;
+
+    else if (strstr(arg, "mesh_x="))
+    return sscanf(arg, "mesh_x=%d", &mesh_x) == 1 && is_mesh_size(mesh_x);
+
+    else if (strstr(arg, "mesh_y="))
+    return sscanf(arg, "mesh_y=%d", &mesh_y) == 1 && is_mesh_size(mesh_y);
+
+    else if (strstr(arg, "mesh_z="))
+    return sscanf(arg, "mesh_z=%d", &mesh_z) == 1 && is_mesh_size(mesh_z);
+
+    else if (strstr(arg, "assign=")) {
+      if (!strcmp(arg, "assign=cic"))
+      assign = PM_CIC;
+      else if (!strcmp(arg, "assign=tsc"))
+      assign = PM_TSC;
+      else
+      return 0;
+      return 1;
+    }
+
+    else if (strstr(arg, "asmth="))
+    return sscanf(arg, "asmth=%f", &asmth) == 1 && asmth > 0;
+
+    else if (strstr(arg, "treepm_rcut="))
+    return sscanf(arg, "treepm_rcut=%f", &treepm_rcut) == 1 && treepm_rcut > 0;
+
+    else if (strstr(arg, "rcut="))
+    return sscanf(arg, "rcut=%f", &rcut) == 1 && rcut > 0;
+
+    else if (strstr(arg, "skin="))
+    return sscanf(arg, "skin=%f", &skin) == 1 && skin >= 0;
+
+    else if (strstr(arg, "tile_i="))
+    return sscanf(arg, "tile_i=%zu", &tile_i) == 1;
+
+    else if (strstr(arg, "tile_j="))
+    return sscanf(arg, "tile_j=%zu", &tile_j) == 1;
+
+    else if (strstr(arg, "simd="))
+    return sscanf(arg, "simd=%15s", simd_name) == 1;
+
+    else if (strstr(arg, "simd_nr="))
+    return sscanf(arg, "simd_nr=%d", &simd_nr) == 1
+    && simd_nr >= 0 && simd_nr <= 2;
+
+    else if (strstr(arg, "block_levels="))
+    return sscanf(arg, "block_levels=%d", &block_levels) == 1
+    && block_levels >= 1 && block_levels <= BLOCK_MAX_LEVELS;
+
+    else if (strstr(arg, "block_eta="))
+    return sscanf(arg, "block_eta=%f", &block_eta) == 1 && block_eta > 0;
+
+    else if (strstr(arg, "respa="))
+    return sscanf(arg, "respa=%zu", &respa_k) == 1;
+
+    else if (strstr(arg, "softening=")) {
+      if (!strcmp(arg, "softening=legacy"))
+      softening = SOFT_LEGACY;
+      else if (!strcmp(arg, "softening=plummer"))
+      softening = SOFT_PLUMMER;
+      else if (!strcmp(arg, "softening=spline"))
+      softening = SOFT_SPLINE;
+      else if (!strcmp(arg, "softening=none"))
+      softening = SOFT_NONE;
+      else
+      return 0;
+      return 1;
+    }
+
+    else if (strstr(arg, "force_check="))
+    return sscanf(arg, "force_check=%zu", &force_check) == 1;
+
+    else if (strstr(arg, "t_end="))
+    return sscanf(arg, "t_end=%f", &t_end) == 1 && t_end >= 0;
+
+    else if (strstr(arg, "dt_eta="))
+    return sscanf(arg, "dt_eta=%f", &dt_eta) == 1 && dt_eta >= 0;
+
+    else if (strstr(arg, "energy_check="))
+    return sscanf(arg, "energy_check=%d", &energy_check) == 1;
+
     // Return 0 if the given command-line parameter was invalid.
     return 0;
   }
@@ -0,0 +1,188 @@
+/**
+* Direct-sum particle simulation in 2D or 3D, built on the dimension
+* templated engine in engine.h. The dimension is picked once on the command
+* line, as is the softening kernel; everything below run<D, K>() is compiled
+* separately for each combination.
+*/
+
+// System header files.
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdio.h>
+#include <string>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// User defined header files.
+#include "engine.h"
+#include "particles.h"
+
+// User defined macros.
+#define DEFAULT_DIM 3
+#define DEFAULT_NPART 1000
+#define DEFAULT_NSTEPS 1000
+#define DEFAULT_WIDTH 1024
+#define DEFAULT_HEIGHT 512
+#define DEFAULT_DEPTH 512
+#define DEFAULT_DELTA_T 1e2
+
+// Namespaces.
+using namespace std;
+using namespace std::chrono; // For timing.
+
+static const string PDPATH = "./particle_positions/";
+
+static int dim = DEFAULT_DIM;
+static size_t npart = DEFAULT_NPART;
+static size_t nsteps = DEFAULT_NSTEPS;
+static float size[3] = {DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_DEPTH};
+static float delta_t = DEFAULT_DELTA_T;
+static float scale_mass = 1.0e6;
+static float G = 6.67384e-11;
+static size_t write_every = 0;         // Steps between output files, 0 for none.
+static int softening = SOFT_LEGACY;    // Softening kernel of the force loop.
+
+/*
+* Print expected usage of this program.
+*/
+static void
+print_usage()
+{
+  cerr << "Usage: [dim=2|3] "
+  << "[width=box_width] "
+  << "[height=box_height] "
+  << "[depth=box_depth] "
+  << "[npart=number_of_particles] "
+  << "[delta_t=inter_frame_interval_in_seconds] "
+  << "[nsteps=number_of_steps] "
+  << "[softening=legacy|plummer|spline|none] "
+  << "[write_every=steps_between_output_files]\n";
+}
+
+/*
+* Process the given command-line parameter.
+* @param arg The command-line parameter.
+* @return 1 on success, 0 on error.*/
+static int
+process_nd_arg(char *arg)
+{
+  if (strstr(arg, "dim="))
+  return sscanf(arg, "dim=%d", &dim) == 1 && (dim == 2 || dim == 3);
+
+  else if (strstr(arg, "width="))
+  return sscanf(arg, "width=%f", &size[0]) == 1;
+
+  else if (strstr(arg, "height="))
+  return sscanf(arg, "height=%f", &size[1]) == 1;
+
+  else if (strstr(arg, "depth="))
+  return sscanf(arg, "depth=%f", &size[2]) == 1;
+
+  else if (strstr(arg, "npart="))
+  return sscanf(arg, "npart=%zu", &npart) == 1;
+
+  else if (strstr(arg, "delta_t="))
+  return sscanf(arg, "delta_t=%f", &delta_t) == 1;
+
+  else if (strstr(arg, "nsteps="))
+  return sscanf(arg, "nsteps=%zu", &nsteps) == 1;
+
+  else if (strstr(arg, "softening=")) {
+    if (!strcmp(arg, "softening=legacy"))
+    softening = SOFT_LEGACY;
+    else if (!strcmp(arg, "softening=plummer"))
+    softening = SOFT_PLUMMER;
+    else if (!strcmp(arg, "softening=spline"))
+    softening = SOFT_SPLINE;
+    else if (!strcmp(arg, "softening=none"))
+    softening = SOFT_NONE;
+    else
+    return 0;
+    return 1;
+  }
+
+  else if (strstr(arg, "write_every="))
+  return sscanf(arg, "write_every=%zu", &write_every) == 1;
+
+  // Return 0 if the given command-line parameter was invalid.
+  return 0;
+}
+
+/*
+* Run the simulation in D dimensions with softening kernel K.
+* @return 0 on success, -1 on failure.*/
+template <int D, class K>
+static int
+run()
+{
+  float center[D], scale[D];
+  for (int d = 0; d < D; ++d) {
+    center[d] = size[d]/3.0;
+    scale[d] = size[d];
+  }
+
+  engine_state<D> state;
+  engine_init(state, npart, center, scale, scale_mass);
+
+  double avg_cpu_time = 0;
+  for (size_t i = 0; i < nsteps; i++) {
+    high_resolution_clock::time_point t1 = high_resolution_clock::now();
+    engine_accelerations<D, K>(state, G, eps);
+    engine_integrate(state, delta_t);
+    high_resolution_clock::time_point t2 = high_resolution_clock::now();
+
+    avg_cpu_time += duration_cast<microseconds>(t2 - t1).count()*1e-3;
+
+    if (write_every > 0 && i % write_every == 0) {
+      string filename("positions_" + to_string(i) + ".vtk");
+      if (!engine_write_vtk(state, PDPATH + filename)) {
+        cerr << "Could not write file: " << filename << "\n";
+        engine_free(state);
+        return -1;
+      }
+    }
+  }
+
+  avg_cpu_time /= nsteps;
+  cout << "dim=" << D << "\n";
+  cout << "avg_cpu_time for update_particles() in ms=" << avg_cpu_time << "\n";
+
+  engine_free(state);
+  return 0;
+}
+
+/*
+* Run the simulation in D dimensions with the selected softening kernel.
+* @return 0 on success, -1 on failure.*/
+template <int D>
+static int
+run_softened()
+{
+  switch (softening) {
+    case SOFT_PLUMMER: return run<D, soft_plummer>();
+    case SOFT_SPLINE: return run<D, soft_spline>();
+    case SOFT_NONE: return run<D, soft_none>();
+    default: return run<D, soft_legacy>();
+  }
+}
+
+int main(int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    if (!process_nd_arg(argv[i])) {
+      cerr << "Invalid argument: " << argv[i] << "\n";
+      print_usage();
+      return -1;
+    }
+  }
+
+#ifdef _OPENMP
+  // The engine's loops take the runtime schedule; particles.cpp sets it
+  // from schedule=, this program always splits them evenly.
+  omp_set_schedule(omp_sched_static, 0);
+#endif
+
+  return dim == 2 ? run_softened<2>() : run_softened<3>();
+}
@@ -0,0 +1,175 @@
+/**
+* NUMA-aware allocation and thread pinning on top of libnuma. Without
+* USE_NUMA the arrays come from new[] and pinning is unavailable.
+*/
+
+#include <iostream>
+#include <new>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef USE_NUMA
+#include <numa.h>
+#include <numaif.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#include "placement.h"
+
+float *
+placement_alloc(size_t n, int policy)
+{
+#ifdef USE_NUMA
+  if (numa_available() >= 0) {
+    size_t bytes = n*sizeof(float);
+    void *p = policy == PLACE_INTERLEAVE ? numa_alloc_interleaved(bytes)
+      : numa_alloc(bytes);
+    if (p == NULL) {
+      std::cerr << "placement: could not allocate " << bytes << " bytes"
+      << (policy == PLACE_INTERLEAVE ? " interleaved" : "") << "\n";
+      throw std::bad_alloc();
+    }
+    return (float *) p;
+  }
+#else
+  (void) policy;
+#endif
+  return new float[n];
+}
+
+void
+placement_free(float *p, size_t n)
+{
+#ifdef USE_NUMA
+  if (numa_available() >= 0) {
+    numa_free(p, n*sizeof(float));
+    return;
+  }
+#else
+  (void) n;
+#endif
+  delete [] p;
+}
+
+int
+placement_pin_threads(int affinity)
+{
+  if (affinity == AFFINITY_NONE) {
+    return 1;
+  }
+#if defined(USE_NUMA) && defined(_OPENMP)
+  if (numa_available() < 0) {
+    return 0;
+  }
+
+  // Allowed CPUs grouped by node.
+  int nnodes = numa_max_node() + 1;
+  std::vector<std::vector<int> > node_cpus(nnodes);
+  std::vector<int> cpus;
+  cpu_set_t allowed;
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  for (int c = 0; c < CPU_SETSIZE; ++c) {
+    if (CPU_ISSET(c, &allowed)) {
+      int node = numa_node_of_cpu(c);
+      node_cpus[node < 0 ? 0 : node].push_back(c);
+    }
+  }
+  std::vector<int> nodes;
+  for (int k = 0; k < nnodes; ++k) {
+    if (!node_cpus[k].empty()) {
+      nodes.push_back(k);
+      cpus.insert(cpus.end(), node_cpus[k].begin(), node_cpus[k].end());
+    }
+  }
+  if (cpus.empty()) {
+    return 0;
+  }
+
+  int ok = 1;
+  #pragma omp parallel reduction(&&:ok)
+  {
+    int t = omp_get_thread_num();
+    int cpu;
+    if (affinity == AFFINITY_COMPACT) {
+      cpu = cpus[t%cpus.size()];
+    } else {
+      const std::vector<int> &own = node_cpus[nodes[t%nodes.size()]];
+      cpu = own[(t/nodes.size())%own.size()];
+    }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    ok = sched_setaffinity(0, sizeof(set), &set) == 0;
+  }
+  return ok;
+#else
+  return 0;
+#endif
+}
+
+void
+placement_report(const char *name, const float *p, size_t n)
+{
+#ifdef USE_NUMA
+  if (numa_available() < 0 || n == 0) {
+    return;
+  }
+
+  long page = sysconf(_SC_PAGESIZE);
+  size_t npages = (n*sizeof(float) + page - 1)/page;
+  size_t nsample = npages < 1024 ? npages : 1024;
+  std::vector<void *> pages(nsample);
+  std::vector<int> status(nsample);
+  for (size_t k = 0; k < nsample; ++k) {
+    pages[k] = (char *) p + (k*npages/nsample)*page;
+  }
+  numa_move_pages(0, nsample, &pages[0], NULL, &status[0], 0);
+
+  int nnodes = numa_max_node() + 1;
+  std::vector<size_t> count(nnodes, 0);
+  size_t unmapped = 0;
+  for (size_t k = 0; k < nsample; ++k) {
+    if (status[k] >= 0 && status[k] < nnodes) {
+      ++count[status[k]];
+    } else {
+      ++unmapped;
+    }
+  }
+
+  std::cout << "placement array=" << name << " pages=" << npages;
+  for (int k = 0; k < nnodes; ++k) {
+    std::cout << " node" << k << "=" << 100.0*count[k]/nsample << "%";
+  }
+  if (unmapped > 0) {
+    std::cout << " unmapped=" << 100.0*unmapped/nsample << "%";
+  }
+  std::cout << "\n";
+#else
+  (void) name;
+  (void) p;
+  (void) n;
+#endif
+}
+
+void
+placement_report_threads()
+{
+#if defined(USE_NUMA) && defined(_OPENMP)
+  int nthreads = omp_get_max_threads();
+  std::vector<int> cpu(nthreads, -1);
+  #pragma omp parallel
+  {
+    cpu[omp_get_thread_num()] = sched_getcpu();
+  }
+
+  for (int t = 0; t < nthreads; ++t) {
+    std::cout << "placement thread=" << t << " cpu=" << cpu[t] << " node="
+    << (numa_available() >= 0 ? numa_node_of_cpu(cpu[t]) : -1) << "\n";
+  }
+#endif
+}
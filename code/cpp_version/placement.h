@@ -0,0 +1,44 @@
+/* NUMA placement of the particle arrays and of the OpenMP threads. */
+#ifndef PLACEMENT_H_INCLUDED
+#define PLACEMENT_H_INCLUDED
+
+#include <stddef.h>
+
+// Page placement of an array.
+#define PLACE_FIRST_TOUCH 0     // Pages go to the node of the first writer.
+#define PLACE_INTERLEAVE 1      // Pages round-robin over all nodes.
+
+// Pinning of OpenMP threads to CPUs.
+#define AFFINITY_NONE 0         // Left to the OS.
+#define AFFINITY_COMPACT 1      // Consecutive threads fill a node first.
+#define AFFINITY_SCATTER 2      // Consecutive threads on different nodes.
+
+/*
+* Allocate n floats with the given placement, or with new[] when built
+* without USE_NUMA. Under PLACE_FIRST_TOUCH no page is touched, so the
+* caller's first (parallel) write decides where each page lives. Like
+* new[], throws std::bad_alloc if the memory cannot be had.
+*/
+extern float *placement_alloc(size_t n, int policy);
+
+extern void placement_free(float *p, size_t n);
+
+/*
+* Pin each thread of the OpenMP team to one CPU. Pinned threads stay on
+* their CPUs for later parallel regions with the same team size.
+* @return 1 on success, 0 if pinning is unsupported or failed.
+*/
+extern int placement_pin_threads(int affinity);
+
+/*
+* Print the share of the pages of p[0..n) on each node, from a sample of
+* at most 1024 pages.
+*/
+extern void placement_report(const char *name, const float *p, size_t n);
+
+/*
+* Print the CPU and node of each thread of the OpenMP team.
+*/
+extern void placement_report_threads();
+
+#endif // PLACEMENT_H_INCLUDED
@@ -0,0 +1,331 @@
+/**
+* Particle-mesh gravity.
+*
+* Masses are assigned to the mesh (CIC or TSC), convolved with the
+* eps-softened acceleration kernel K(D) = -G D/(|D|+eps)^3 using FFTs on a
+* mesh padded to twice its size (Hockney & Eastwood's method for isolated
+* boundaries), and interpolated back to the particles with the same
+* assignment weights so that there is no self-force.
+*
+* The x and y kernels are packed into one complex array as Kx + i*Ky, so a
+* step costs one forward and two inverse FFTs. Kernel transforms are cached
+* and only recomputed when the mesh size, spacing or split scale changes.
+*
+* For TreePM the kernel is multiplied by the long-range fraction of the
+* Gaussian force split, which is smooth on the mesh scale when r_s is larger
+* than about one mesh cell.
+*
+* Every pass runs on OpenMP threads. The FFTs transform independent lines,
+* and the interpolation reads the mesh. For the mass assignment the
+* particles are binned by the first x-plane of their stencil; the bins of
+* planes a stencil width apart touch disjoint planes, so they are filled
+* concurrently in one sweep per residue, and the sums do not depend on the
+* thread count.
+*/
+
+#include <algorithm>
+#include <complex>
+#include <math.h>
+#include <vector>
+
+#include "pm.h"
+
+using namespace std;
+
+typedef complex<double> cplx;
+
+static int mesh_n[3] = {0, 0, 0};   // Mesh points per axis (unpadded).
+static double mesh_h[3];            // Mesh spacing per axis.
+static float mesh_asmth = -1;       // Split scale the kernels were built for.
+static vector<cplx> kxy;            // Transform of Kx + i*Ky.
+static vector<cplx> kz;             // Transform of Kz.
+static vector<cplx> rho;            // Mass on the padded mesh, then its transform.
+static vector<cplx> w1, w2;         // Accelerations on the padded mesh.
+static vector<int> plane;           // First x-plane of each particle's stencil.
+static vector<size_t> plane_start;  // Particles of plane i are
+static vector<size_t> plane_part;   // plane_part[plane_start[i]..[i + 1]).
+
+/*
+* In-place radix-2 FFT of n (a power of two) contiguous values.
+* @param sign -1 for the forward transform, +1 for the inverse (unscaled).
+*/
+static void
+fft1d(cplx *a, int n, int sign, const cplx *roots)
+{
+  for (int i = 1, j = 0; i < n; ++i) {
+    int bit = n >> 1;
+    for (; j & bit; bit >>= 1) {
+      j ^= bit;
+    }
+    j ^= bit;
+    if (i < j) {
+      swap(a[i], a[j]);
+    }
+  }
+
+  for (int len = 2; len <= n; len <<= 1) {
+    int step = n/len;
+    for (int i = 0; i < n; i += len) {
+      for (int k = 0; k < len/2; ++k) {
+        cplx w = roots[k*step];
+        if (sign > 0) {
+          w = conj(w);
+        }
+        cplx u = a[i + k];
+        cplx v = a[i + k + len/2]*w;
+        a[i + k] = u + v;
+        a[i + k + len/2] = u - v;
+      }
+    }
+  }
+}
+
+/*
+* FFT along every axis of an n0*n1*n2 row-major array.
+*/
+static void
+fft3d(vector<cplx> &a, const int *n, int sign)
+{
+  size_t stride[3] = {(size_t) n[1]*n[2], (size_t) n[2], 1};
+  size_t total = (size_t) n[0]*n[1]*n[2];
+
+  for (int axis = 0; axis < 3; ++axis) {
+    int len = n[axis];
+    vector<cplx> roots(len/2);
+    for (int k = 0; k < len/2; ++k) {
+      roots[k] = polar(1.0, -2.0*M_PI*k/len);
+    }
+
+    size_t s = stride[axis];
+    size_t nlines = total/len;
+    #pragma omp parallel
+    {
+      vector<cplx> line(len);
+
+      // Line l starts at its element with index 0 along the axis.
+      #pragma omp for schedule(static)
+      for (size_t l = 0; l < nlines; ++l) {
+        size_t base = (l/s)*len*s + l%s;
+        for (int k = 0; k < len; ++k) {
+          line[k] = a[base + k*s];
+        }
+        fft1d(&line[0], len, sign, &roots[0]);
+        for (int k = 0; k < len; ++k) {
+          a[base + k*s] = line[k];
+        }
+      }
+    }
+  }
+}
+
+/*
+* Assignment weights of a particle at mesh coordinate u.
+* @return Index of the first mesh point; w[] receives 2 (CIC) or 3 (TSC) weights.
+*/
+static int
+assign_weights(double u, int assign, double *w)
+{
+  if (assign == PM_TSC) {
+    int i = (int) floor(u + 0.5);
+    double f = u - i;
+    w[0] = 0.5*(0.5 - f)*(0.5 - f);
+    w[1] = 0.75 - f*f;
+    w[2] = 0.5*(0.5 + f)*(0.5 + f);
+    return i - 1;
+  }
+
+  int i = (int) floor(u);
+  double f = u - i;
+  w[0] = 1.0 - f;
+  w[1] = f;
+  return i;
+}
+
+/*
+* Tabulate and transform the acceleration kernels for the current mesh.
+*/
+static void
+build_kernels(const int *np, double G, double eps, double rs)
+{
+  size_t total = (size_t) np[0]*np[1]*np[2];
+  kxy.assign(total, cplx(0.0, 0.0));
+  kz.assign(total, cplx(0.0, 0.0));
+
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i < np[0]; ++i) {
+    double dx = (i < np[0]/2 ? i : i - np[0])*mesh_h[0];
+    for (int j = 0; j < np[1]; ++j) {
+      double dy = (j < np[1]/2 ? j : j - np[1])*mesh_h[1];
+      for (int k = 0; k < np[2]; ++k) {
+        double dz = (k < np[2]/2 ? k : k - np[2])*mesh_h[2];
+        double r = sqrt(dx*dx + dy*dy + dz*dz);
+        if (r == 0.0) {
+          continue;
+        }
+        double d = r + eps;
+        double s = -G/(d*d*d);
+        if (rs > 0.0) {
+          // Long-range fraction, evaluated in double to avoid cancellation.
+          double u = 0.5*r/rs;
+          s *= erf(u) - 1.1283791670955126*u*exp(-u*u);
+        }
+        size_t idx = ((size_t) i*np[1] + j)*np[2] + k;
+        kxy[idx] = cplx(s*dx, s*dy);
+        kz[idx] = cplx(s*dz, 0.0);
+      }
+    }
+  }
+
+  fft3d(kxy, np, -1);
+  fft3d(kz, np, -1);
+}
+
+double
+pm_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps,
+  float size_x, float size_y, float size_z, int nx, int ny, int nz,
+  int assign, float asmth)
+{
+  if (npart == 0) {
+    return 0.0;
+  }
+
+  const float *pos[3] = {px, py, pz};
+  float *acc[3] = {ax, ay, az};
+  double size[3] = {size_x, size_y, size_z};
+  int n[3] = {nx, ny, nz};
+  int np[3] = {2*nx, 2*ny, 2*nz};
+
+  // Bounding box of the particles.
+  double lo[3], hi[3];
+  for (int d = 0; d < 3; ++d) {
+    const float *q = pos[d];
+    float qlo = q[0], qhi = q[0];
+    #pragma omp parallel for schedule(static) reduction(min:qlo) reduction(max:qhi)
+    for (size_t i = 1; i < npart; ++i) {
+      qlo = min(qlo, q[i]);
+      qhi = max(qhi, q[i]);
+    }
+    lo[d] = qlo;
+    hi[d] = qhi;
+  }
+
+  // The mesh keeps its spacing until the particles outgrow it, leaving two
+  // spare points on each side for the assignment stencil.
+  bool rebuild = false;
+  for (int d = 0; d < 3; ++d) {
+    double extent = hi[d] - lo[d];
+    if (mesh_n[d] != n[d]) {
+      mesh_n[d] = n[d];
+      mesh_h[d] = max(size[d], extent)/(n[d] - 4);
+      rebuild = true;
+    } else if (extent > (n[d] - 4)*mesh_h[d]) {
+      mesh_h[d] = 1.25*extent/(n[d] - 4);
+      rebuild = true;
+    }
+  }
+  if (asmth != mesh_asmth) {
+    mesh_asmth = asmth;
+    rebuild = true;
+  }
+
+  double rs = asmth*max(mesh_h[0], max(mesh_h[1], mesh_h[2]));
+  if (rebuild) {
+    build_kernels(np, G, eps, rs);
+  }
+
+  double origin[3];
+  for (int d = 0; d < 3; ++d) {
+    origin[d] = 0.5*(lo[d] + hi[d]) - 0.5*(n[d] - 1)*mesh_h[d];
+  }
+
+  size_t total = (size_t) np[0]*np[1]*np[2];
+  int nw = assign == PM_TSC ? 3 : 2;
+
+  // Bin the particles by the first x-plane of their stencil.
+  plane.resize(npart);
+  #pragma omp parallel for schedule(static)
+  for (size_t p = 0; p < npart; ++p) {
+    double w[3];
+    plane[p] = assign_weights((pos[0][p] - origin[0])/mesh_h[0], assign, w);
+  }
+  plane_start.assign(np[0] + 1, 0);
+  plane_part.resize(npart);
+  for (size_t p = 0; p < npart; ++p) {
+    ++plane_start[plane[p] + 1];
+  }
+  for (int i = 0; i < np[0]; ++i) {
+    plane_start[i + 1] += plane_start[i];
+  }
+  vector<size_t> fill(plane_start.begin(), plane_start.end() - 1);
+  for (size_t p = 0; p < npart; ++p) {
+    plane_part[fill[plane[p]]++] = p;
+  }
+
+  // Mass assignment, planes i = r (mod nw) at a time.
+  rho.assign(total, cplx(0.0, 0.0));
+  for (int r = 0; r < nw; ++r) {
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = r; i < np[0]; i += nw) {
+      for (size_t k = plane_start[i]; k < plane_start[i + 1]; ++k) {
+        size_t p = plane_part[k];
+        double w[3][3];
+        int first[3];
+        for (int d = 0; d < 3; ++d) {
+          first[d] = assign_weights((pos[d][p] - origin[d])/mesh_h[d], assign,
+            w[d]);
+        }
+        for (int a = 0; a < nw; ++a) {
+          for (int b = 0; b < nw; ++b) {
+            size_t row = ((size_t) (first[0] + a)*np[1] + (first[1] + b))
+              *np[2];
+            for (int c = 0; c < nw; ++c) {
+              rho[row + first[2] + c] += mass[p]*w[0][a]*w[1][b]*w[2][c];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Convolution with the kernels.
+  fft3d(rho, np, -1);
+  w1.resize(total);
+  w2.resize(total);
+  #pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < total; ++k) {
+    w1[k] = rho[k]*kxy[k];
+    w2[k] = rho[k]*kz[k];
+  }
+  fft3d(w1, np, 1);
+  fft3d(w2, np, 1);
+  double scale = 1.0/total;
+
+  // Interpolation back to the particles.
+  #pragma omp parallel for schedule(runtime)
+  for (size_t p = 0; p < npart; ++p) {
+    double w[3][3];
+    int first[3];
+    for (int d = 0; d < 3; ++d) {
+      first[d] = assign_weights((pos[d][p] - origin[d])/mesh_h[d], assign, w[d]);
+    }
+    double a[3] = {0.0, 0.0, 0.0};
+    for (int i = 0; i < nw; ++i) {
+      for (int j = 0; j < nw; ++j) {
+        size_t row = ((size_t) (first[0] + i)*np[1] + (first[1] + j))*np[2];
+        for (int k = 0; k < nw; ++k) {
+          double wt = w[0][i]*w[1][j]*w[2][k];
+          a[0] += wt*w1[row + first[2] + k].real();
+          a[1] += wt*w1[row + first[2] + k].imag();
+          a[2] += wt*w2[row + first[2] + k].real();
+        }
+      }
+    }
+    for (int d = 0; d < 3; ++d) {
+      acc[d][p] = (float) (a[d]*scale);
+    }
+  }
+
+  return rs;
+}
@@ -0,0 +1,45 @@
+/* Particle-mesh (PM) gravity on a zero-padded FFT mesh. */
+#ifndef PM_H_INCLUDED
+#define PM_H_INCLUDED
+
+#include <math.h>
+#include <stddef.h>
+
+// Mass assignment schemes.
+#define PM_CIC 0   // Cloud-in-cell, 2^3 mesh points per particle.
+#define PM_TSC 1   // Triangular-shaped cloud, 3^3 mesh points per particle.
+
+/*
+* Compute accelerations on an nx*ny*nz mesh (each a power of two) that spans
+* at least size_x*size_y*size_z around the particles. The mesh is padded to
+* twice its size so boundaries are isolated rather than periodic.
+*
+* The mesh only resolves forces over a few cells: on the default 64*32*32
+* mesh (2000 particles, default box) the RMS / maximum relative error
+* against the direct sum is 0.35 / 2.6, against 7.5e-3 / 1.8e-2 once TreePM
+* or P3M add the short-range part. make check holds them to 0.5 / 4 and
+* 1.5e-2 / 4e-2.
+*
+* When asmth > 0 only the long-range part of the force is computed, split at
+* the scale r_s = asmth mesh cells (see pm_short_range_factor()).
+* @return r_s, or 0 for the full force.
+*/
+extern double pm_accelerations(size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps,
+  float size_x, float size_y, float size_z, int nx, int ny, int nz,
+  int assign, float asmth = 0);
+
+/*
+* Fraction of the force at separation r that belongs to the short-range part
+* of the Gaussian force split at scale r_s: erfc(u) + 2u/sqrt(pi) exp(-u^2),
+* with u = r/(2 r_s). The long-range part is one minus this.
+*/
+inline float
+pm_short_range_factor(float r, float inv_2rs)
+{
+  float u = r*inv_2rs;
+  return erfcf(u) + 1.1283791671f*u*expf(-u*u);
+}
+
+#endif // PM_H_INCLUDED
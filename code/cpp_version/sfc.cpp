@@ -0,0 +1,164 @@
+/**
+* Morton and Hilbert keys and a parallel radix sort, used to lay out
+* particles that are close in space close in memory.
+*/
+
+#include <math.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "sfc.h"
+
+/*
+* Hilbert transform of the grid coordinates x, in place (Skilling 2004,
+* "Programming the Hilbert curve"): afterwards, interleaving the bits of
+* x[0], x[1], x[2] from the top gives the Hilbert index.
+*/
+static void
+hilbert_transpose(unsigned x[3], int bits)
+{
+  unsigned m = 1u << (bits - 1);
+
+  // Inverse undo.
+  for (unsigned q = m; q > 1; q >>= 1) {
+    unsigned p = q - 1;
+    for (int i = 0; i < 3; ++i) {
+      if (x[i] & q) {
+        x[0] ^= p;
+      } else {
+        unsigned t = (x[0] ^ x[i]) & p;
+        x[0] ^= t;
+        x[i] ^= t;
+      }
+    }
+  }
+
+  // Gray encode.
+  x[1] ^= x[0];
+  x[2] ^= x[1];
+  unsigned t = 0;
+  for (unsigned q = m; q > 1; q >>= 1) {
+    if (x[2] & q) {
+      t ^= q - 1;
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    x[i] ^= t;
+  }
+}
+
+static sfc_key
+interleave(const unsigned x[3], int bits)
+{
+  sfc_key key = 0;
+  for (int b = bits - 1; b >= 0; --b) {
+    key = (key << 3) | (((x[0] >> b) & 1) << 2) | (((x[1] >> b) & 1) << 1)
+      | ((x[2] >> b) & 1);
+  }
+  return key;
+}
+
+void
+sfc_order(sfc_state &sfc, size_t npart,
+  const float *px, const float *py, const float *pz, int curve)
+{
+  sfc.keys.resize(npart);
+  sfc.keys_tmp.resize(npart);
+  sfc.perm.resize(npart);
+  sfc.perm_tmp.resize(npart);
+  if (npart == 0) {
+    return;
+  }
+
+  float lo[3] = {px[0], py[0], pz[0]};
+  float hi[3] = {px[0], py[0], pz[0]};
+  for (size_t i = 1; i < npart; ++i) {
+    lo[0] = fminf(lo[0], px[i]); hi[0] = fmaxf(hi[0], px[i]);
+    lo[1] = fminf(lo[1], py[i]); hi[1] = fmaxf(hi[1], py[i]);
+    lo[2] = fminf(lo[2], pz[i]); hi[2] = fmaxf(hi[2], pz[i]);
+  }
+
+  // Cubic cells keep the curve's locality the same along every axis.
+  float extent = fmaxf(hi[0] - lo[0], fmaxf(hi[1] - lo[1], hi[2] - lo[2]));
+  unsigned top = (1u << SFC_BITS) - 1;
+  float scale = extent > 0 ? top/extent : 0;
+
+  sfc_key *keys = &sfc.keys[0];
+  size_t *perm = &sfc.perm[0];
+  #pragma omp parallel for schedule(static)
+  for (size_t i = 0; i < npart; ++i) {
+    unsigned x[3] = {
+      (unsigned) ((px[i] - lo[0])*scale),
+      (unsigned) ((py[i] - lo[1])*scale),
+      (unsigned) ((pz[i] - lo[2])*scale)
+    };
+    for (int d = 0; d < 3; ++d) {
+      x[d] = x[d] > top ? top : x[d];
+    }
+    if (curve == SFC_HILBERT) {
+      hilbert_transpose(x, SFC_BITS);
+    }
+    keys[i] = interleave(x, SFC_BITS);
+    perm[i] = i;
+  }
+
+  size_t nbins = (size_t) 1 << SFC_RADIX_BITS;
+  sfc_key mask = nbins - 1;
+  for (int shift = 0; shift < 3*SFC_BITS; shift += SFC_RADIX_BITS) {
+    sfc_key *in = &sfc.keys[0], *out = &sfc.keys_tmp[0];
+    size_t *pin = &sfc.perm[0], *pout = &sfc.perm_tmp[0];
+    bool skip = false;
+
+    #pragma omp parallel
+    {
+#ifdef _OPENMP
+      int nthreads = omp_get_num_threads();
+      int t = omp_get_thread_num();
+#else
+      int nthreads = 1;
+      int t = 0;
+#endif
+
+      #pragma omp single
+      sfc.counts.assign((size_t) nthreads*nbins, 0);
+
+      size_t *counts = &sfc.counts[(size_t) t*nbins];
+
+      #pragma omp for schedule(static)
+      for (size_t i = 0; i < npart; ++i) {
+        ++counts[(in[i] >> shift) & mask];
+      }
+
+      // Offsets of each thread within each digit, digits in order.
+      #pragma omp single
+      {
+        size_t total = 0;
+        for (size_t b = 0; b < nbins; ++b) {
+          size_t first = total;
+          for (int k = 0; k < nthreads; ++k) {
+            size_t count = sfc.counts[(size_t) k*nbins + b];
+            sfc.counts[(size_t) k*nbins + b] = total;
+            total += count;
+          }
+          skip = skip || total - first == npart;
+        }
+      }
+
+      if (!skip) {
+        #pragma omp for schedule(static)
+        for (size_t i = 0; i < npart; ++i) {
+          size_t slot = counts[(in[i] >> shift) & mask]++;
+          out[slot] = in[i];
+          pout[slot] = pin[i];
+        }
+      }
+    }
+
+    if (!skip) {
+      sfc.keys.swap(sfc.keys_tmp);
+      sfc.perm.swap(sfc.perm_tmp);
+    }
+  }
+}
@@ -0,0 +1,67 @@
+/* Space-filling-curve ordering of the particles. */
+#ifndef SFC_H_INCLUDED
+#define SFC_H_INCLUDED
+
+#include <stddef.h>
+#include <vector>
+
+// Curves.
+#define SFC_NONE 0
+#define SFC_MORTON 1
+#define SFC_HILBERT 2
+
+// Bits per coordinate of a key, so a key has 3*SFC_BITS bits.
+#define SFC_BITS 21
+// Bits of the key sorted per radix sort pass.
+#define SFC_RADIX_BITS 8
+
+typedef unsigned long long sfc_key;
+
+/*
+* Keys, the permutation of the last sort and scratch space, kept between
+* reorderings. perm[k] is the old index of the particle now at k.
+*/
+struct sfc_state {
+  std::vector<sfc_key> keys;
+  std::vector<sfc_key> keys_tmp;
+  std::vector<size_t> perm;
+  std::vector<size_t> perm_tmp;
+  std::vector<size_t> counts;   // Per-thread digit histograms.
+  std::vector<char> scratch;    // Copy of the array being permuted.
+};
+
+/*
+* Key each particle by its cell on a 2^SFC_BITS grid over the bounding box
+* along the Morton (Z-order) or Hilbert curve, and sort the keys with a
+* parallel LSD radix sort into sfc.perm. Each pass histograms digits per
+* thread, turns the counts into offsets with a prefix sum and scatters
+* with the same static partition, so the sort is stable and the order does
+* not depend on the thread count. Passes in which all keys share a digit
+* are skipped.
+*/
+extern void sfc_order(sfc_state &sfc, size_t npart,
+  const float *px, const float *py, const float *pz, int curve);
+
+/*
+* Reorder a[0..npart) by sfc.perm in place: the array keeps its address.
+*/
+template <class T>
+void
+sfc_permute(sfc_state &sfc, size_t npart, T *a)
+{
+  sfc.scratch.resize(npart*sizeof(T));
+  T *tmp = (T *) &sfc.scratch[0];
+  const size_t *perm = &sfc.perm[0];
+
+  #pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < npart; ++k) {
+    tmp[k] = a[perm[k]];
+  }
+
+  #pragma omp parallel for schedule(static)
+  for (size_t k = 0; k < npart; ++k) {
+    a[k] = tmp[k];
+  }
+}
+
+#endif // SFC_H_INCLUDED
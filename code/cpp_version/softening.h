@@ -0,0 +1,142 @@
+/**
+* Softening kernels for the direct, blocked and cutoff force loops.
+*
+* Each kernel gives the factor g(r2) such that the acceleration of particle i
+* due to particle j is G*m_j*g*(x_j - x_i), and the matching pair potential
+* phi(r2) such that the potential energy of the pair is G*m_i*m_j*phi. They
+* are template arguments of the force loops, so the chosen kernel is inlined
+* and the others cost nothing; both are templates on the floating-point type
+* so that the double precision checks use the same law. Kernels that are
+* finite at r = 0 need no i != j test: the separation is zero there and so
+* is the contribution.
+*/
+#ifndef SOFTENING_H_INCLUDED
+#define SOFTENING_H_INCLUDED
+
+#include <cmath>
+
+// Softening kernels selectable at run time with softening=.
+#define SOFT_LEGACY 0
+#define SOFT_PLUMMER 1
+#define SOFT_SPLINE 2
+#define SOFT_NONE 3
+
+// Cubic spline support in units of eps, so that the potential at r = 0
+// matches a Plummer sphere of scale eps.
+#define SOFT_SPLINE_SUPPORT 2.8f
+
+/*
+* The law used by particles.cpp: 1/(r + eps)^3.
+*/
+struct soft_legacy {
+  static const bool self_check = false;
+
+  template <class T>
+  static inline T
+  factor(T r2, T eps)
+  {
+    T d = std::sqrt(r2) + eps;
+    return T(1)/(d*d*d);
+  }
+
+  template <class T>
+  static inline T
+  potential(T r2, T eps)
+  {
+    T r = std::sqrt(r2);
+    T d = r + eps;
+    return -(2*r + eps)/(2*d*d);
+  }
+};
+
+/*
+* Plummer: 1/(r^2 + eps^2)^(3/2).
+*/
+struct soft_plummer {
+  static const bool self_check = false;
+
+  template <class T>
+  static inline T
+  factor(T r2, T eps)
+  {
+    T d2 = r2 + eps*eps;
+    return T(1)/(d2*std::sqrt(d2));
+  }
+
+  template <class T>
+  static inline T
+  potential(T r2, T eps)
+  {
+    return -T(1)/std::sqrt(r2 + eps*eps);
+  }
+};
+
+/*
+* Cubic spline (Monaghan & Lattanzio 1985) with compact support
+* h = SOFT_SPLINE_SUPPORT*eps: exactly Newtonian beyond h.
+*/
+struct soft_spline {
+  static const bool self_check = false;
+
+  template <class T>
+  static inline T
+  factor(T r2, T eps)
+  {
+    T h = T(SOFT_SPLINE_SUPPORT)*eps;
+    T r = std::sqrt(r2);
+    if (r >= h) {
+      return T(1)/(r2*r);
+    }
+
+    T u = r/h;
+    T h3 = h*h*h;
+    if (u < T(0.5)) {
+      return (T(10.666666667) + u*u*(T(32.0)*u - T(38.4)))/h3;
+    }
+    return (T(21.333333333) - T(48.0)*u + T(38.4)*u*u
+      - T(10.666666667)*u*u*u - T(0.066666667)/(u*u*u))/h3;
+  }
+
+  template <class T>
+  static inline T
+  potential(T r2, T eps)
+  {
+    T h = T(SOFT_SPLINE_SUPPORT)*eps;
+    T r = std::sqrt(r2);
+    if (r >= h) {
+      return -T(1)/r;
+    }
+
+    T u = r/h;
+    if (u < T(0.5)) {
+      return (T(-2.8) + u*u*(T(5.333333333) + u*u*(T(6.4)*u - T(9.6))))/h;
+    }
+    return (T(-3.2) + T(0.066666667)/u + u*u*(T(10.666666667)
+      + u*(T(-16.0) + u*(T(9.6) - T(2.133333333)*u))))/h;
+  }
+};
+
+/*
+* Unsoftened 1/r^3, singular at r = 0, so the force loop must skip j == i.
+*/
+struct soft_none {
+  static const bool self_check = true;
+
+  template <class T>
+  static inline T
+  factor(T r2, T eps)
+  {
+    (void) eps;
+    return T(1)/(r2*std::sqrt(r2));
+  }
+
+  template <class T>
+  static inline T
+  potential(T r2, T eps)
+  {
+    (void) eps;
+    return -T(1)/std::sqrt(r2);
+  }
+};
+
+#endif // SOFTENING_H_INCLUDED
@@ -0,0 +1,113 @@
+/**
+* Short-range half of the TreePM force split.
+*
+* The long-range part comes from pm_accelerations() with asmth > 0. Here the
+* octree is walked for each particle, pruning every cell whose bounding box
+* lies farther than rcut, and the eps-softened kernel is multiplied by the
+* short-range fraction pm_short_range_factor(). The two halves add up to the
+* full softened force apart from the truncation at rcut.
+*/
+
+#include <math.h>
+
+#include "pm.h"
+#include "treepm.h"
+
+void
+treepm_short_range(const bh_tree &tree, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float theta,
+  float rs, float rcut)
+{
+  if (tree.nodes.empty()) {
+    return;
+  }
+
+  const bh_node *nodes = &tree.nodes[0];
+  const size_t *index = &tree.index[0];
+  float inv_2rs = 0.5f/rs;
+  float rcut2 = rcut*rcut;
+
+  #pragma omp parallel for schedule(runtime)
+  for (size_t i = 0; i < npart; ++i) {
+    float xi = px[i];
+    float yi = py[i];
+    float zi = pz[i];
+
+    float axi = 0.0, ayi = 0.0, azi = 0.0;
+
+    int stack[8*(BH_MAX_DEPTH + 1)];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+      const bh_node &node = nodes[stack[--top]];
+
+      // Distance from the particle to the cell's bounding box.
+      float bx = fabsf(node.cx - xi) - node.half;
+      float by = fabsf(node.cy - yi) - node.half;
+      float bz = fabsf(node.cz - zi) - node.half;
+      bx = bx > 0 ? bx : 0;
+      by = by > 0 ? by : 0;
+      bz = bz > 0 ? bz : 0;
+      if (bx*bx + by*by + bz*bz > rcut2) {
+        continue;
+      }
+
+      if (!node.leaf) {
+        float dx = node.mx - xi;
+        float dy = node.my - yi;
+        float dz = node.mz - zi;
+        float r2 = dx*dx + dy*dy + dz*dz;
+
+        float ox = node.mx - node.cx;
+        float oy = node.my - node.cy;
+        float oz = node.mz - node.cz;
+        float open = theta > 0
+          ? 2.0f*node.half/theta + sqrt(ox*ox + oy*oy + oz*oz) : 0;
+
+        if (theta <= 0 || r2 <= open*open) {
+          for (int k = 0; k < 8; ++k) {
+            if (node.child[k] >= 0) {
+              stack[top++] = node.child[k];
+            }
+          }
+          continue;
+        }
+
+        float r = sqrt(r2);
+        if (r < rcut) {
+          float d = r + eps;
+          float s = G*node.mass*pm_short_range_factor(r, inv_2rs)/(d*d*d);
+          axi += s*dx;
+          ayi += s*dy;
+          azi += s*dz;
+        }
+        continue;
+      }
+
+      for (size_t k = node.begin; k < node.end; ++k) {
+        size_t j = index[k];
+        if (j != i) {
+          float dx = px[j] - xi;
+          float dy = py[j] - yi;
+          float dz = pz[j] - zi;
+          float r2 = dx*dx + dy*dy + dz*dz;
+
+          if (r2 < rcut2) {
+            float r = sqrt(r2);
+            float d = r + eps;
+            float s = G*mass[j]*pm_short_range_factor(r, inv_2rs)/(d*d*d);
+            axi += s*dx;
+            ayi += s*dy;
+            azi += s*dz;
+          }
+        }
+      }
+    }
+
+    ax[i] += axi;
+    ay[i] += ayi;
+    az[i] += azi;
+  }
+}
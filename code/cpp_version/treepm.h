@@ -0,0 +1,20 @@
+/* TreePM / P3M: long-range forces on the PM mesh, short-range forces by tree. */
+#ifndef TREEPM_H_INCLUDED
+#define TREEPM_H_INCLUDED
+
+#include <stddef.h>
+
+#include "barnes_hut.h"
+
+/*
+* Add the short-range part of the Gaussian force split at scale rs to
+* ax/ay/az, visiting only cells within rcut of each particle. Cells passing
+* the Barnes-Hut criterion for theta act as point masses; theta = 0 sums
+* all pairs within rcut directly (P3M).
+*/
+extern void treepm_short_range(const bh_tree &tree, size_t npart,
+  const float *px, const float *py, const float *pz, const float *mass,
+  float *ax, float *ay, float *az, float G, float eps, float theta,
+  float rs, float rcut);
+
+#endif // TREEPM_H_INCLUDED
@@ -0,0 +1,268 @@
+/**
+* Work-stealing loops on per-worker Chase-Lev deques (Chase and Lev 2005,
+* with the C++11 memory orders of Le et al. 2013, "Correct and efficient
+* work-stealing for weak memory models").
+*
+* The deques have a fixed number of slots. A push to a full deque fails and
+* the worker simply keeps the whole range, so nothing is ever lost. A loop
+* ends when the count of queued and running ranges drops to zero.
+*/
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "worksteal.h"
+
+#define WS_MASK (WS_DEQUE_SIZE - 1)
+
+static double
+ws_now()
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void
+ws_store(ws_slot &s, const ws_task &t)
+{
+  s.run.store(t.run, std::memory_order_relaxed);
+  s.ctx.store(t.ctx, std::memory_order_relaxed);
+  s.begin.store(t.begin, std::memory_order_relaxed);
+  s.end.store(t.end, std::memory_order_relaxed);
+  s.grain.store(t.grain, std::memory_order_relaxed);
+}
+
+static void
+ws_load(const ws_slot &s, ws_task &t)
+{
+  t.run = s.run.load(std::memory_order_relaxed);
+  t.ctx = s.ctx.load(std::memory_order_relaxed);
+  t.begin = s.begin.load(std::memory_order_relaxed);
+  t.end = s.end.load(std::memory_order_relaxed);
+  t.grain = s.grain.load(std::memory_order_relaxed);
+}
+
+/*
+* Owner: push t at the bottom.
+* @return false if the deque is full.
+*/
+static bool
+ws_push(ws_worker &w, const ws_task &t)
+{
+  long b = w.bottom.load(std::memory_order_relaxed);
+  long top = w.top.load(std::memory_order_acquire);
+  if (b - top >= WS_DEQUE_SIZE) {
+    return false;
+  }
+  ws_store(w.slots[b & WS_MASK], t);
+  std::atomic_thread_fence(std::memory_order_release);
+  w.bottom.store(b + 1, std::memory_order_relaxed);
+  return true;
+}
+
+/*
+* Owner: take the newest task, racing the thieves only for the last one.
+*/
+static bool
+ws_pop(ws_worker &w, ws_task &t)
+{
+  long b = w.bottom.load(std::memory_order_relaxed) - 1;
+  w.bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long top = w.top.load(std::memory_order_relaxed);
+
+  if (top > b) {
+    w.bottom.store(b + 1, std::memory_order_relaxed);
+    return false;
+  }
+  ws_load(w.slots[b & WS_MASK], t);
+  if (top == b) {
+    bool won = w.top.compare_exchange_strong(top, top + 1,
+      std::memory_order_seq_cst, std::memory_order_relaxed);
+    w.bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+  }
+  return true;
+}
+
+/*
+* Thief: take the oldest task of w. The slot is copied before the CAS
+* claims it; if the owner reused the slot meanwhile, top has moved on and
+* the CAS fails, so a torn or stale copy is never run.
+*/
+static bool
+ws_steal(ws_worker &w, ws_task &t)
+{
+  long top = w.top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  long b = w.bottom.load(std::memory_order_acquire);
+  if (top >= b) {
+    return false;
+  }
+  ws_load(w.slots[top & WS_MASK], t);
+  return w.top.compare_exchange_strong(top, top + 1,
+    std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+/*
+* Split t down to its grain, leaving the upper halves for thieves, and run
+* what is left.
+*/
+static void
+ws_execute(ws_pool &pool, ws_worker &w, ws_task t)
+{
+  while (t.end - t.begin > t.grain) {
+    ws_task upper = t;
+    upper.begin = t.begin + (t.end - t.begin)/2;
+    pool.pending.fetch_add(1, std::memory_order_relaxed);
+    if (!ws_push(w, upper)) {
+      pool.pending.fetch_sub(1, std::memory_order_relaxed);
+      break;
+    }
+    t.end = upper.begin;
+  }
+
+  t.run(t.ctx, t.begin, t.end);
+  ++w.tasks;
+  pool.pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+/*
+* Worker self of nw: run its own tasks, then steal until no range is left.
+*/
+static void
+ws_work(ws_pool &pool, int self, int nw)
+{
+  ws_worker &w = pool.workers[self];
+  double idle_since = -1;
+
+  for (;;) {
+    ws_task t;
+    bool got = ws_pop(w, t);
+
+    // One round of nw - 1 random victims.
+    for (int k = 1; !got && k < nw; ++k) {
+      w.seed ^= w.seed << 13;
+      w.seed ^= w.seed >> 17;
+      w.seed ^= w.seed << 5;
+      int victim = (self + 1 + w.seed%(nw - 1))%nw;
+      got = ws_steal(pool.workers[victim], t);
+      ++(got ? w.steals : w.failed_steals);
+    }
+
+    if (got) {
+      if (idle_since >= 0) {
+        w.idle += ws_now() - idle_since;
+        idle_since = -1;
+      }
+      ws_execute(pool, w, t);
+      continue;
+    }
+
+    if (idle_since < 0) {
+      idle_since = ws_now();
+    }
+    if (pool.pending.load(std::memory_order_acquire) == 0) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+
+  if (idle_since >= 0) {
+    w.idle += ws_now() - idle_since;
+  }
+}
+
+void
+ws_init(ws_pool &pool, int nworkers)
+{
+  pool.nworkers = nworkers > 0 ? nworkers : 1;
+  pool.workers = new ws_worker[pool.nworkers];
+  for (int k = 0; k < pool.nworkers; ++k) {
+    ws_worker &w = pool.workers[k];
+    w.top.store(0);
+    w.bottom.store(0);
+    w.seed = 2463534242u + 2654435761u*k;
+    w.tasks = 0;
+    w.steals = 0;
+    w.failed_steals = 0;
+    w.idle = 0;
+  }
+  pool.pending.store(0);
+  pool.loops = 0;
+  pool.worker_time = 0;
+}
+
+void
+ws_free(ws_pool &pool)
+{
+  delete [] pool.workers;
+  pool.workers = NULL;
+  pool.nworkers = 0;
+}
+
+int
+ws_workers(const ws_pool &pool)
+{
+#ifdef _OPENMP
+  int n = omp_get_max_threads();
+  return n < pool.nworkers ? n : pool.nworkers;
+#else
+  (void) pool;
+  return 1;
+#endif
+}
+
+void
+ws_for(ws_pool &pool, size_t n, size_t grain, ws_body body, void *ctx)
+{
+  if (n == 0) {
+    return;
+  }
+
+  // The first range is queued before the team starts, so no worker can see
+  // an empty pool and leave early.
+  ws_task root = {body, ctx, 0, n, grain > 0 ? grain : 1};
+  pool.pending.store(1);
+  ws_push(pool.workers[0], root);
+
+  int nw = ws_workers(pool);
+  double t0 = ws_now();
+  #pragma omp parallel num_threads(nw)
+  {
+#ifdef _OPENMP
+    ws_work(pool, omp_get_thread_num(), omp_get_num_threads());
+#else
+    ws_work(pool, 0, 1);
+#endif
+  }
+  pool.worker_time += (ws_now() - t0)*nw;
+  ++pool.loops;
+}
+
+void
+ws_report(const ws_pool &pool)
+{
+  size_t tasks = 0, steals = 0, failed = 0;
+  double idle = 0;
+  for (int k = 0; k < pool.nworkers; ++k) {
+    const ws_worker &w = pool.workers[k];
+    std::cout << "steal worker=" << k << " tasks=" << w.tasks << " steals="
+    << w.steals << " failed_steals=" << w.failed_steals << " idle_ms="
+    << w.idle*1e3 << "\n";
+    tasks += w.tasks;
+    steals += w.steals;
+    failed += w.failed_steals;
+    idle += w.idle;
+  }
+
+  std::cout << "steal_total loops=" << pool.loops << " tasks=" << tasks
+  << " steals=" << steals << " failed_steals=" << failed << " idle_ms="
+  << idle*1e3 << " idle_fraction="
+  << (pool.worker_time > 0 ? idle/pool.worker_time : 0) << "\n";
+}
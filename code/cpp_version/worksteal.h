@@ -0,0 +1,86 @@
+/* Work-stealing scheduler for the irregular tree and cell passes. */
+#ifndef WORKSTEAL_H_INCLUDED
+#define WORKSTEAL_H_INCLUDED
+
+#include <atomic>
+#include <stddef.h>
+
+// Slots of each worker's deque; a power of two.
+#define WS_DEQUE_SIZE 1024
+// Padding that keeps the hot fields of different workers on separate lines.
+#define WS_CACHE_LINE 64
+
+// Work on the range [begin, end) of a loop; ctx carries the loop's data.
+typedef void (*ws_body)(void *ctx, size_t begin, size_t end);
+
+struct ws_task {
+  ws_body run;
+  void *ctx;
+  size_t begin, end;
+  size_t grain;         // Ranges longer than this are split before running.
+};
+
+/*
+* A deque slot. A thief may read a slot while its owner refills it, so the
+* fields are atomics accessed with relaxed order; the CAS on top decides
+* whether the copy is used.
+*/
+struct ws_slot {
+  std::atomic<ws_body> run;
+  std::atomic<void *> ctx;
+  std::atomic<size_t> begin, end;
+  std::atomic<size_t> grain;
+};
+
+/*
+* A Chase-Lev deque and the statistics of one worker. The owner pushes and
+* pops at bottom; thieves take the oldest (largest) ranges at top.
+*/
+struct ws_worker {
+  std::atomic<long> top;
+  char pad0[WS_CACHE_LINE];
+  std::atomic<long> bottom;
+  char pad1[WS_CACHE_LINE];
+  ws_slot slots[WS_DEQUE_SIZE];
+  unsigned seed;        // State of the victim choice.
+  size_t tasks;         // Ranges run.
+  size_t steals;        // Ranges taken from other workers.
+  size_t failed_steals; // Attempts that found an empty deque or lost a race.
+  double idle;          // Time spent looking for work, in s.
+  char pad2[WS_CACHE_LINE];
+};
+
+struct ws_pool {
+  int nworkers;                 // Workers allocated, one per OpenMP thread.
+  ws_worker *workers;
+  std::atomic<long> pending;    // Ranges queued or running in this loop.
+  size_t loops;                 // Calls of ws_for.
+  double worker_time;           // Sum over loops of wall time x workers, in s.
+};
+
+extern void ws_init(ws_pool &pool, int nworkers);
+
+extern void ws_free(ws_pool &pool);
+
+/*
+* Run body over [0, n) on the OpenMP team (at most pool.nworkers threads).
+* The whole range starts on worker 0; a worker holding a range longer than
+* grain pushes its upper half and keeps the lower half, and idle workers
+* steal from random victims, so the ranges left in the deques are the large
+* ones and load balances however uneven the cost per index is. Must be
+* called outside a parallel region.
+*/
+extern void ws_for(ws_pool &pool, size_t n, size_t grain, ws_body body,
+  void *ctx);
+
+/*
+* Workers ws_for would use now.
+*/
+extern int ws_workers(const ws_pool &pool);
+
+/*
+* Print the ranges run, steals and idle time of each worker and in total.
+*/
+extern void ws_report(const ws_pool &pool);
+
+#endif // WORKSTEAL_H_INCLUDED